@@ -25,6 +25,10 @@ void token::create( const name&   issuer,
       s.refund_delay = 0;
       s.fee_ratio = 0;
       s.fee_receiver = issuer;
+      s.upgrade();
+      // a new symbol has no rows yet, so every owner is counted from the start
+      s.counted_through.value() = std::numeric_limits<uint64_t>::max();
+      s.fee_enabled.value() = true;
    });
 
    staketotal totaltable( get_self(), get_first_receiver().value );
@@ -34,6 +38,7 @@ void token::create( const name&   issuer,
 
    totaltable.emplace(get_self(), [&]( auto& r) {
       r.staked_balance_total = asset{ 0, sym };
+      r.upgrade();
    });   
 }
 
@@ -47,10 +52,54 @@ void token::setdelay(const symbol& symbol, uint64_t delaytime) {
    check( st.supply.symbol.code() == symbol.code(), "symbol precision mismatch" );
 
    statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
       s.refund_delay = delaytime;
    });
 }
 
+void token::setfeesplit(const symbol& symbol, uint64_t burn_bps, uint64_t stake_bps) {
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol.code() == symbol.code(), "symbol precision mismatch" );
+   check( burn_bps <= 10000 && stake_bps <= 10000, "fee share exceeds 10000 basis points" );
+   check( burn_bps + stake_bps <= 10000, "fee split exceeds 10000 basis points" );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+      s.fee_burn_bps.value() = burn_bps;
+      s.fee_stake_bps.value() = stake_bps;
+      s.fee_enabled.value() = true;
+   });
+}
+
+void token::setfeeexempt(const symbol& symbol, name account, bool exempt) {
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol.code() == symbol.code(), "symbol precision mismatch" );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+      auto& list = s.fee_exempt.value();
+      auto it = std::lower_bound( list.begin(), list.end(), account );
+      bool listed = it != list.end() && *it == account;
+      if( exempt && !listed ) {
+         check( list.size() < max_fee_exempt, "fee exemption list is full" );
+         check( is_account( account ), "account does not exist" );
+         list.insert( it, account );
+      } else if( !exempt && listed ) {
+         list.erase( it );
+      }
+   });
+}
+
 void token::settransfee(const symbol& symbol, uint64_t ratio, name receiver) {
    auto sym_code_raw = symbol.code().raw();
 
@@ -64,11 +113,123 @@ void token::settransfee(const symbol& symbol, uint64_t ratio, name receiver) {
    check( ratio >= 0 && ratio <= 100, " transfer fee is out of boundary");
    
    statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
       s.fee_ratio = ratio;
       s.fee_receiver = receiver;
+      s.fee_enabled.value() = true;
+   });
+}
+
+void token::setflags(const symbol& symbol, uint8_t flags) {
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol.code() == symbol.code(), "symbol precision mismatch" );
+   check( ( flags & ~flag_mask ) == 0, "unknown flag" );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+      s.flags.value() = flags;
    });
 }
 
+void token::setgcidle(const symbol& symbol, uint64_t idletime) {
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol.code() == symbol.code(), "symbol precision mismatch" );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+      s.gc_idle.value() = idletime;
+      if( s.gc_epoch.value() == 0 ) {
+         s.gc_epoch.value() = current_time_point().sec_since_epoch();
+      }
+   });
+}
+
+void token::migrate(const symbol& symbol) {
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+   });
+
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   auto total_itr = totaltable.find( sym_code_raw );
+   if( total_itr != totaltable.end() ) {
+      totaltable.modify( total_itr, same_payer, [&]( auto& r ) {
+         r.upgrade();
+      });
+   }
+}
+
+void token::setemission(const symbol& symbol, uint64_t rate) {
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+
+   // settle the elapsed time at the old rate before switching
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   accrue_rewards( statstable, st, totaltable );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+      s.emission_rate.value() = rate;
+      s.last_emission.value() = current_time_point().sec_since_epoch();
+   });
+}
+
+void token::fundrampool(const symbol& symbol, uint64_t rows, uint64_t per_account) {
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+   check( rows <= std::numeric_limits<uint32_t>::max() / sponsored_row_bytes, "too many rows to fund at once" );
+
+   if( rows > 0 ) {
+      // the issuer buys the RAM for the contract account, which then pays for sponsored rows
+      action( permission_level{ st.issuer, rampool_permission }, "eosio"_n, "buyrambytes"_n,
+              std::make_tuple( st.issuer, get_self(), static_cast<uint32_t>( rows * sponsored_row_bytes ) )
+      ).send();
+   }
+
+   rampools pooltable( get_self(), sym_code_raw );
+   auto pool = pooltable.find( sym_code_raw );
+   if( pool == pooltable.end() ) {
+      pooltable.emplace( st.issuer, [&]( auto& p ) {
+         p.sym = symbol;
+         p.capacity = rows;
+         p.used = 0;
+         p.per_account = per_account;
+      });
+   } else {
+      pooltable.modify( pool, same_payer, [&]( auto& p ) {
+         p.capacity += rows;
+         p.per_account = per_account;
+      });
+   }
+}
+
 void token::issue( const name& to, const asset& quantity, const string& memo )
 {
    check( is_account( to ), "to account does not exist" );
@@ -89,11 +250,13 @@ void token::issue( const name& to, const asset& quantity, const string& memo )
    check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
    check( quantity.amount <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply");
 
+   holder_delta holders{ st };
+   add_balance( st.issuer, quantity, st.issuer, holders );
+
    statstable.modify( st, same_payer, [&]( auto& s ) {
       s.supply += quantity;
+      holders.apply( s );
    });
-
-   add_balance( st.issuer, quantity, st.issuer );
 }
 
 void token::retire( const asset& quantity, const string& memo )
@@ -113,11 +276,13 @@ void token::retire( const asset& quantity, const string& memo )
 
    check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
 
+   holder_delta holders{ st };
+   sub_balance( st.issuer, quantity, holders );
+
    statstable.modify( st, same_payer, [&]( auto& s ) {
       s.supply -= quantity;
+      holders.apply( s );
    });
-
-   sub_balance( st.issuer, quantity );
 }
 
 void token::transfer(const name&    from,
@@ -139,57 +304,678 @@ void token::transfer(const name&    from,
    check( quantity.amount > 0, "must transfer positive quantity" );
    check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
    check( memo.size() <= 256, "memo has more than 256 bytes" );
+   check( !( st.flags.value_or() & ( flag_paused | flag_freeze_transfers ) ), "transfers are frozen for this symbol" );
 
    auto payer = has_auth( to ) ? to : from;
 
-   sub_balance( from, quantity );
-   add_balance( to, quantity, payer );
+   auto fee = transfer_fee( st, from, to, quantity.amount );
+   check( fee < quantity.amount, "quantity does not cover the transfer fee" );
+
+   holder_delta holders{ st };
+   sub_balance( from, quantity, holders );
+   add_balance( to, asset{ quantity.amount - fee, quantity.symbol }, payer, holders );
+   route_fee( st, payer, fee, holders );
+   update_holder_stats( statstable, st, holders );
+
+   activity_bucket delta{};
+   delta.transfers = 1;
+   delta.volume = quantity.amount;
+   record_activity( quantity.symbol, delta );
+}
+
+void token::schedule(const name&    from,
+                     const name&    to,
+                     const asset&   quantity,
+                     uint64_t       interval,
+                     uint64_t       first_due,
+                     uint64_t       count )
+{
+   check( from != to, "cannot schedule transfer to self" );
+   require_auth( from );
+   check( is_account( to ), "to account does not exist");
+   auto sym = quantity.symbol.code();
+   stats statstable( get_self(), sym.raw() );
+   const auto& st = statstable.get( sym.raw() );
+
+   check( quantity.is_valid(), "invalid quantity" );
+   check( quantity.amount > 0, "must transfer positive quantity" );
+   check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+   check( !( st.flags.value_or() & ( flag_paused | flag_freeze_transfers ) ), "transfers are frozen for this symbol" );
+   check( count > 0, "must schedule at least one transfer" );
+   check( count == 1 || interval > 0, "recurring transfer needs a positive interval" );
+   check( count <= uint64_t(asset::max_amount / quantity.amount), "scheduled total overflows" );
+   auto start = std::max<uint64_t>( first_due, current_time_point().sec_since_epoch() );
+   check( count == 1 || interval <= ( std::numeric_limits<uint64_t>::max() - start ) / ( count - 1 ), "schedule end overflows" );
+
+   // the whole schedule is reserved up front and paid out of it by execute
+   holder_delta holders{ st };
+   sub_balance( from, quantity * int64_t(count), holders );
+
+   // the recipient's row is opened now, at the sender's expense, so execute never pays RAM
+   accounts to_acnts( get_self(), to.value );
+   if( to_acnts.find( sym.raw() ) == to_acnts.end() ) {
+      add_balance( to, asset{ 0, quantity.symbol }, from, holders );
+   }
+   update_holder_stats( statstable, st, holders );
+
+   schedules scheduletable( get_self(), sym.raw() );
+   scheduletable.emplace( from, [&]( auto& s ) {
+      s.id = scheduletable.available_primary_key();
+      s.from = from;
+      s.to = to;
+      s.amount = quantity;
+      s.interval = interval;
+      s.next_due = start;
+      s.remaining = count;
+   });
 }
 
-void token::stake(name owner, asset quantity) {
+void token::unschedule(const name& from, const symbol& symbol, uint64_t id) {
+   require_auth( from );
+
+   auto sym_code_raw = symbol.code().raw();
+   schedules scheduletable( get_self(), sym_code_raw );
+   const auto& s = scheduletable.get( id, "schedule not found" );
+   check( s.from == from, "schedule belongs to another account" );
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   holder_delta holders{ st };
+   add_balance( from, s.amount * int64_t(s.remaining), from, holders );
+   update_holder_stats( statstable, st, holders );
+
+   scheduletable.erase( s );
+}
+
+void token::execute(const symbol& symbol, uint64_t max_count) {
+   check( max_count > 0 && max_count <= max_execute_batch, "invalid execute batch size" );
+
+   auto sym_code_raw = symbol.code().raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+   check( symbol == st.supply.symbol, "symbol precision mismatch" );
+
+   // a frozen symbol's payments stay due and are made by a later crank
+   if( st.flags.value_or() & ( flag_paused | flag_freeze_transfers ) ) return;
+
+   auto now = current_time_point().sec_since_epoch();
+   schedules scheduletable( get_self(), sym_code_raw );
+   auto due_idx = scheduletable.get_index<"bydue"_n>();
+
+   // only payments count against max_count, entries passed over have their own cap so that
+   // they neither block the ones behind them nor make the walk unbounded
+   holder_delta holders{ st };
+   activity_bucket delta{};
+   uint64_t paid = 0;
+   uint64_t skipped = 0;
+   auto itr = due_idx.begin();
+   while( paid < max_count && skipped < max_execute_skips && itr != due_idx.end() && itr->next_due <= now ) {
+      // a modified entry moves within the index, so the next one is taken first
+      auto next = itr;
+      ++next;
+
+      // the row opened by schedule is gone, paying now would need RAM from someone, so the
+      // entry stays due and is paid once the recipient opens the row again
+      accounts to_acnts( get_self(), itr->to.value );
+      if( to_acnts.find( sym_code_raw ) == to_acnts.end() ) {
+         ++skipped;
+         itr = next;
+         continue;
+      }
+
+      // the fee is charged at payment time, like a transfer made now, but the crank cannot
+      // open a row for the fee receiver so the payment stays due until the receiver has one
+      auto fee = transfer_fee( st, itr->from, itr->to, itr->amount.amount );
+      if( fee > 0 ) {
+         accounts receiver_acnts( get_self(), st.fee_receiver.value );
+         if( receiver_acnts.find( sym_code_raw ) == receiver_acnts.end() ) {
+            ++skipped;
+            itr = next;
+            continue;
+         }
+      }
+
+      // both rows exist, `from` is never charged RAM here
+      add_balance( itr->to, asset{ itr->amount.amount - fee, symbol }, itr->from, holders );
+      route_fee( st, itr->from, fee, holders );
+      ++paid;
+      delta.volume += itr->amount.amount;
+
+      if( itr->remaining == 1 ) {
+         itr = due_idx.erase( itr );
+      } else {
+         due_idx.modify( itr, same_payer, [&]( auto& s ) {
+            s.remaining -= 1;
+            s.next_due += s.interval;
+         });
+         itr = next;
+      }
+   }
+
+   if( paid == 0 ) return;
+   update_holder_stats( statstable, st, holders );
+
+   delta.transfers = static_cast<uint32_t>( paid );
+   record_activity( symbol, delta );
+}
+
+void token::subscribe(const name&    subscriber,
+                      const name&    merchant,
+                      const asset&   quantity,
+                      uint64_t       period )
+{
+   check( subscriber != merchant, "cannot subscribe to self" );
+   require_auth( subscriber );
+   check( is_account( merchant ), "merchant account does not exist");
+   auto sym = quantity.symbol.code();
+   stats statstable( get_self(), sym.raw() );
+   const auto& st = statstable.get( sym.raw() );
+
+   check( quantity.is_valid(), "invalid quantity" );
+   check( quantity.amount > 0, "must grant positive quantity" );
+   check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+   check( period > 0, "period must be positive" );
+
+   subscriptions subtable( get_self(), merchant.value );
+   auto it = subtable.find( subscriber.value );
+   if( it == subtable.end() ) {
+      subtable.emplace( subscriber, [&]( auto& r ) {
+         r.subscriber = subscriber;
+         r.amount = quantity;
+         r.period = period;
+         r.last_charged = 0;
+      });
+   } else {
+      subtable.modify( it, same_payer, [&]( auto& r ) {
+         r.amount = quantity;
+         r.period = period;
+      });
+   }
+}
+
+void token::unsubscribe(const name& subscriber, const name& merchant) {
+   require_auth( subscriber );
+
+   subscriptions subtable( get_self(), merchant.value );
+   const auto& r = subtable.get( subscriber.value, "subscription not found" );
+   subtable.erase( r );
+}
+
+void token::charge(const name& merchant, const std::vector<name>& subscribers) {
+   require_auth( merchant );
+
+   auto now = current_time_point().sec_since_epoch();
+   subscriptions subtable( get_self(), merchant.value );
+
+   // the merchant is credited once per symbol after every subscriber is debited
+   std::vector<symbol_transfers> totals;
+
+   for( const auto& subscriber : subscribers ) {
+      // one subscriber who cancelled, closed their row or ran dry does not fail the others
+      auto r = subtable.find( subscriber.value );
+      if( r == subtable.end() ) continue;
+      if( r->last_charged != 0 && now - r->last_charged < r->period ) continue;
+
+      accounts sub_acnts( get_self(), subscriber.value );
+      auto balance = sub_acnts.find( r->amount.symbol.code().raw() );
+      if( balance == sub_acnts.end() ) continue;
+      if( balance->balance.amount - balance->staked_balance.amount < r->amount.amount ) continue;
+
+      auto& total = transfers_for( totals, r->amount.symbol );
+      auto fee = transfer_fee( total.stats, subscriber, merchant, r->amount.amount );
+      if( fee >= r->amount.amount ) continue;
+
+      require_recipient( subscriber );
+      sub_balance( subscriber, r->amount, total.holders );
+      total.quantity += r->amount;
+      total.transfers += 1;
+      total.fees += fee;
+      total.fee_payer = merchant;
+
+      subtable.modify( r, same_payer, [&]( auto& s ) {
+         s.last_charged = now;
+      });
+   }
+
+   // symbols whose every subscriber was skipped move nothing
+   totals.erase( std::remove_if( totals.begin(), totals.end(), []( const auto& t ) { return t.transfers == 0; } ),
+                 totals.end() );
+   for( auto& total : totals ) {
+      add_balance( merchant, asset{ total.quantity.amount - total.fees, total.quantity.symbol }, merchant, total.holders );
+   }
+   flush_transfers( totals );
+}
+
+void token::swap(const name&    party_a,
+                 const name&    party_b,
+                 const asset&   a_gives,
+                 const asset&   b_gives )
+{
+   std::vector<symbol_transfers> totals;
+   settle_swap( swap_leg{ party_a, party_b, a_gives, b_gives }, totals );
+   flush_transfers( totals );
+}
+
+void token::swapmany(const std::vector<swap_leg>& legs) {
+   check( !legs.empty(), "no swaps to settle" );
+
+   std::vector<symbol_transfers> totals;
+   for( const auto& leg : legs ) {
+      settle_swap( leg, totals );
+   }
+   flush_transfers( totals );
+}
+
+void token::settle_swap( const swap_leg& leg, std::vector<symbol_transfers>& totals )
+{
+   check( leg.party_a != leg.party_b, "cannot swap with self" );
+   require_auth( leg.party_a );
+   require_auth( leg.party_b );
+
+   check( leg.a_gives.is_valid() && leg.b_gives.is_valid(), "invalid quantity" );
+   check( leg.a_gives.amount > 0 && leg.b_gives.amount > 0, "must swap positive quantity" );
+   check( leg.a_gives.symbol.code() != leg.b_gives.symbol.code(), "cannot swap a symbol for itself" );
+
+   require_recipient( leg.party_a );
+   require_recipient( leg.party_b );
+
+   // each party pays RAM for the row it receives into, both of them signed
+   auto& a_total = transfers_for( totals, leg.a_gives.symbol );
+   auto a_fee = transfer_fee( a_total.stats, leg.party_a, leg.party_b, leg.a_gives.amount );
+   check( a_fee < leg.a_gives.amount, "quantity does not cover the transfer fee" );
+   sub_balance( leg.party_a, leg.a_gives, a_total.holders );
+   add_balance( leg.party_b, asset{ leg.a_gives.amount - a_fee, leg.a_gives.symbol }, leg.party_b, a_total.holders );
+   a_total.quantity += leg.a_gives;
+   a_total.transfers += 1;
+   a_total.fees += a_fee;
+   a_total.fee_payer = leg.party_a;
+
+   auto& b_total = transfers_for( totals, leg.b_gives.symbol );
+   auto b_fee = transfer_fee( b_total.stats, leg.party_b, leg.party_a, leg.b_gives.amount );
+   check( b_fee < leg.b_gives.amount, "quantity does not cover the transfer fee" );
+   sub_balance( leg.party_b, leg.b_gives, b_total.holders );
+   add_balance( leg.party_a, asset{ leg.b_gives.amount - b_fee, leg.b_gives.symbol }, leg.party_a, b_total.holders );
+   b_total.quantity += leg.b_gives;
+   b_total.transfers += 1;
+   b_total.fees += b_fee;
+   b_total.fee_payer = leg.party_b;
+}
+
+token::symbol_transfers& token::transfers_for( std::vector<symbol_transfers>& totals, const symbol& symbol )
+{
+   auto total = std::find_if( totals.begin(), totals.end(), [&]( const auto& t ) {
+      return t.quantity.symbol == symbol;
+   });
+   if( total != totals.end() ) return *total;
+
+   // the stats row is checked and kept for the fee settings the first time a symbol is seen
+   stats statstable( get_self(), symbol.code().raw() );
+   const auto& st = statstable.get( symbol.code().raw(), "symbol does not exist" );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+   check( !( st.flags.value_or() & ( flag_paused | flag_freeze_transfers ) ), "transfers are frozen for this symbol" );
+
+   totals.push_back( symbol_transfers{ asset{ 0, symbol }, 0, holder_delta{ st }, st, 0, name{} } );
+   return totals.back();
+}
+
+void token::flush_transfers( std::vector<symbol_transfers>& totals )
+{
+   for( auto& total : totals ) {
+      route_fee( total.stats, total.fee_payer, total.fees, total.holders );
+
+      auto sym_code_raw = total.quantity.symbol.code().raw();
+      stats statstable( get_self(), sym_code_raw );
+      const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+      update_holder_stats( statstable, st, total.holders );
+
+      activity_bucket delta{};
+      delta.transfers = total.transfers;
+      delta.volume = total.quantity.amount;
+      record_activity( total.quantity.symbol, delta );
+   }
+}
+
+void token::stake(name owner, asset quantity, eosio::binary_extension<uint8_t> tier) {
+   require_auth(owner);
+   auto lock = tier.value_or();
+   check(lock < lock_tiers.size(), "unknown lock tier");
+
+   accounts from_acnts(get_self(), owner.value);
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   stake_from(from_acnts, totaltable, owner, quantity, lock);
+}
+
+void token::stakemany(name owner, const std::vector<asset>& quantities, uint8_t tier) {
    require_auth(owner);
+   check(!quantities.empty(), "no quantities to stake");
+   check(tier < lock_tiers.size(), "unknown lock tier");
+
+   // one accounts scope and one totalstake table serve every symbol of the batch
+   accounts from_acnts(get_self(), owner.value);
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   for( const auto& quantity : quantities ) {
+      stake_from(from_acnts, totaltable, owner, quantity, tier);
+   }
+}
 
+void token::stake_from(accounts& from_acnts, staketotal& totaltable, const name& owner, const asset& quantity, uint8_t tier) {
    check( quantity.is_valid(), "invalid quantity");
    check( quantity.amount > 0, "must stake positive quantity");
 
    const auto& sym_code_raw = quantity.symbol.code().raw();
 
-   accounts from_acnts(get_self(), owner.value);
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get(sym_code_raw, "symbol does not exist");
+   check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+   check( !( st.flags.value_or() & ( flag_paused | flag_freeze_stake ) ), "staking is frozen for this symbol" );
+
    const auto& from = from_acnts.get(sym_code_raw, "no balance object found");
 
    check(from.balance >= (from.staked_balance + quantity), "overdrawn balance for stake action");
 
-   from_acnts.modify(from, owner, [&]( auto& a ) {
+   holder_delta holders{ st };
+   holders.stake( owner, from.staked_balance.amount, from.staked_balance.amount + quantity.amount );
+
+   from_acnts.modify(from, same_payer, [&]( auto& a ) {
       a.staked_balance += quantity;
    });
 
+   add_stake(statstable, st, totaltable, owner, quantity, owner, tier);
+   update_holder_stats( statstable, st, holders );
+
+   activity_bucket delta{};
+   delta.staked = quantity.amount;
+   record_activity( quantity.symbol, delta );
+}
+
+void token::stakefor(const name&    from,
+                     const name&    to,
+                     const asset&   quantity,
+                     const string&  memo )
+{
+   check( from != to, "cannot stake for self, use stake" );
+   require_auth( from );
+   check( is_account( to ), "to account does not exist");
+   auto sym = quantity.symbol.code();
+   stats statstable( get_self(), sym.raw() );
+   const auto& st = statstable.get( sym.raw() );
+
+   require_recipient( from );
+   require_recipient( to );
+
+   check( quantity.is_valid(), "invalid quantity" );
+   check( quantity.amount > 0, "must stake positive quantity" );
+   check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+   check( memo.size() <= 256, "memo has more than 256 bytes" );
+   check( !( st.flags.value_or() & ( flag_paused | flag_freeze_transfers | flag_freeze_stake ) ), "stakefor is frozen for this symbol" );
+
+   auto payer = has_auth( to ) ? to : from;
+
+   auto fee = transfer_fee( st, from, to, quantity.amount );
+   check( fee < quantity.amount, "quantity does not cover the transfer fee" );
+   asset staked{ quantity.amount - fee, quantity.symbol };
+
+   // the fee is routed before the new stake exists, so `to` does not share in its own fee
+   holder_delta holders{ st };
+   sub_balance( from, quantity, holders );
+   route_fee( st, payer, fee, holders );
+
+   // credit balance and staked balance in one write to the recipient's row
+   accounts to_acnts( get_self(), to.value );
+   auto it = to_acnts.find( sym.raw() );
+   if( it == to_acnts.end() ) {
+      holders.balance( to, 0, staked.amount );
+      holders.stake( to, 0, staked.amount );
+      auto ram = sponsor_ram( payer, quantity.symbol );
+      to_acnts.emplace( ram, [&]( auto& a ){
+         a.balance = staked;
+         a.staked_balance = staked;
+         a.last_active.emplace( current_time_point().sec_since_epoch() );
+         a.ram_sponsor.emplace( ram == get_self() ? payer : name{} );
+      });
+   } else {
+      holders.balance( to, it->balance.amount, it->balance.amount + staked.amount );
+      holders.stake( to, it->staked_balance.amount, it->staked_balance.amount + staked.amount );
+      to_acnts.modify( it, same_payer, [&]( auto& a ) {
+         a.balance += staked;
+         a.staked_balance += staked;
+      });
+   }
+
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   add_stake( statstable, st, totaltable, to, staked, payer, 0 );
+   update_holder_stats( statstable, st, holders );
+
+   activity_bucket delta{};
+   delta.transfers = 1;
+   delta.volume = quantity.amount;
+   delta.staked = staked.amount;
+   record_activity( quantity.symbol, delta );
+}
+
+void token::add_stake( stats& statstable, const currency_stats& st, staketotal& totaltable,
+                       const name& owner, const asset& quantity, const name& ram_payer, uint8_t tier ) {
+   const auto& sym_code_raw = quantity.symbol.code().raw();
+   auto now = current_time_point().sec_since_epoch();
+   auto reward_per_share = accrue_rewards( statstable, st, totaltable );
+
    stakestats stakestable( get_self(), sym_code_raw);
    auto userstake = stakestable.find(owner.value);
 
+   uint64_t boosted_before = 0;
+   uint64_t boosted_after = 0;
    if(userstake == stakestable.end()) {
-      stakestable.emplace(owner, [&]( auto& r ) {
+      stakestable.emplace(ram_payer, [&]( auto& r ) {
          r.owner = owner;
          r.staked_balance = quantity;
+         r.tier.emplace( tier );
+         r.unlock_time.emplace( tier > 0 ? now + lock_tiers[tier].days * seconds_per_day : 0 );
+         r.boosted.emplace( boosted_weight( quantity.amount, tier ) );
+         r.reward_debt.emplace( reward_per_share );
+         r.pending_reward.emplace( 0 );
+         boosted_after = r.boosted.value();
       });
    } else {
-      stakestable.modify(userstake, same_payer, [&]( auto& r ) {
+      boosted_before = userstake->weight();
+      stakestable.modify(userstake, userstake->write_payer( ram_payer ), [&]( auto& r ) {
+         settle_rewards( r, reward_per_share );
          r.staked_balance += quantity;
+         expire_lock( r, now );
+         // an equal or longer tier relocks the whole stake, a shorter one joins the active lock
+         if( tier > 0 && tier >= r.tier.value() ) {
+            r.tier.value() = tier;
+            r.unlock_time.value() = now + lock_tiers[tier].days * seconds_per_day;
+         }
+         r.boosted.value() = boosted_weight( r.staked_balance.amount, r.tier.value() );
+         boosted_after = r.boosted.value();
       });
    }
 
-   staketotal totaltable( get_self(), get_first_receiver().value );
    auto total_itr = totaltable.find(sym_code_raw);
 
    check( total_itr != totaltable.end(), "token object does not exist ");
 
    totaltable.modify(total_itr, get_self(), [&]( auto& r ) {
+      r.upgrade();
       r.staked_balance_total += quantity;
+      r.boosted_total.value() += boosted_after - boosted_before;
+   });
+}
+
+uint64_t token::boosted_weight( int64_t amount, uint8_t tier ) {
+   return static_cast<uint64_t>( uint128_t( amount ) * lock_tiers[tier].multiplier / 10000 );
+}
+
+void token::settle_rewards( stake_stats& r, uint128_t reward_per_share ) {
+   r.upgrade();
+   // boosted weight never exceeds the total it was accrued against, so this stays within 2^62 * precision
+   r.pending_reward.value() += static_cast<int64_t>( uint128_t( r.boosted.value() ) * ( reward_per_share - r.reward_debt.value() ) / reward_precision );
+   r.reward_debt.value() = reward_per_share;
+}
+
+int64_t token::pending_emission( const currency_stats& st, uint64_t weight, uint32_t now ) {
+   auto emission_rate = st.emission_rate.value_or();
+   auto last_emission = st.last_emission.value_or();
+   // nothing is minted while nobody stakes, there would be no one to pay it to
+   if( emission_rate == 0 || now <= last_emission || weight == 0 ) return 0;
+
+   uint128_t minted = uint128_t( emission_rate ) * ( now - last_emission );
+   return static_cast<int64_t>( std::min<uint128_t>( minted, st.max_supply.amount - st.supply.amount ) );
+}
+
+uint128_t token::accrue_rewards( stats& statstable, const currency_stats& st, staketotal& totaltable ) {
+   const auto& total = totaltable.get( st.supply.symbol.code().raw(), "token object does not exist" );
+
+   auto now = current_time_point().sec_since_epoch();
+   if( st.emission_rate.value_or() == 0 || now <= st.last_emission.value_or() ) return total.reward_per_share.value_or();
+
+   uint128_t minted = pending_emission( st, total.weight(), now );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+      s.supply.amount += static_cast<int64_t>( minted );
+      s.last_emission.value() = now;
+   });
+
+   if( minted > 0 ) {
+      totaltable.modify( total, same_payer, [&]( auto& r ) {
+         r.upgrade();
+         r.reward_per_share.value() += minted * reward_precision / r.boosted_total.value();
+      });
+   }
+   return total.reward_per_share.value_or();
+}
+
+void token::claim(name owner, const symbol& symbol) {
+   require_auth(owner);
+
+   auto sym_code_raw = symbol.code().raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   auto reward_per_share = accrue_rewards( statstable, st, totaltable );
+
+   stakestats stakestable( get_self(), sym_code_raw );
+   const auto& userstake = stakestable.get( owner.value, "user not found" );
+
+   auto now = current_time_point().sec_since_epoch();
+   auto boosted_before = userstake.weight();
+   asset reward{ 0, symbol };
+   stakestable.modify( userstake, userstake.write_payer( owner ), [&]( auto& r ) {
+      settle_rewards( r, reward_per_share );
+      reward.amount = r.pending_reward.value();
+      r.pending_reward.value() = 0;
+      // rewards up to now were earned with the boost, from here on an expired lock earns tier 0
+      expire_lock( r, now );
+      r.boosted.value() = boosted_weight( r.staked_balance.amount, r.tier.value() );
+   });
+   check( reward.amount > 0, "no reward to claim" );
+
+   if( userstake.boosted.value() != boosted_before ) {
+      const auto& total = totaltable.get( sym_code_raw, "token object does not exist" );
+      totaltable.modify( total, get_self(), [&]( auto& r ) {
+         r.upgrade();
+         r.boosted_total.value() -= boosted_before - userstake.boosted.value();
+      });
+   }
+
+   holder_delta holders{ st };
+   add_balance( owner, reward, owner, holders );
+   update_holder_stats( statstable, st, holders );
+}
+
+void token::expirelock(name owner, const symbol& symbol) {
+   auto sym_code_raw = symbol.code().raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+
+   stakestats stakestable( get_self(), sym_code_raw );
+   const auto& userstake = stakestable.get( owner.value, "user not found" );
+
+   auto now = current_time_point().sec_since_epoch();
+   check( userstake.tier.value_or() > 0, "stake is not locked" );
+   check( !is_locked( userstake, now ), "lock has not expired yet" );
+
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   auto reward_per_share = accrue_rewards( statstable, st, totaltable );
+
+   // a locked row was written with every field, so nothing grows and nobody pays RAM
+   auto boosted_before = userstake.weight();
+   stakestable.modify( userstake, same_payer, [&]( auto& r ) {
+      settle_rewards( r, reward_per_share );
+      expire_lock( r, now );
+      r.boosted.value() = boosted_weight( r.staked_balance.amount, r.tier.value() );
+   });
+
+   const auto& total = totaltable.get( sym_code_raw, "token object does not exist" );
+   totaltable.modify( total, same_payer, [&]( auto& r ) {
+      r.upgrade();
+      r.boosted_total.value() -= boosted_before - userstake.boosted.value();
+   });
+}
+
+bool token::is_locked( const stake_stats& r, uint32_t now ) {
+   return r.tier.value_or() > 0 && r.unlock_time.value_or() > now;
+}
+
+void token::expire_lock( stake_stats& r, uint32_t now ) {
+   if( r.tier.value_or() > 0 && r.unlock_time.value_or() <= now ) {
+      r.tier.value() = 0;
+      r.unlock_time.value() = 0;
+   }
+}
+
+void token::record_activity( const symbol& symbol, const activity_bucket& delta ) {
+   uint32_t day = current_time_point().sec_since_epoch() / seconds_per_day;
+
+   // one small row per day slot, so a transfer rewrites the totals of today only
+   activitytable acttable( get_self(), symbol.code().raw() );
+   auto slot = acttable.find( day % activity_days );
+   if( slot == acttable.end() ) {
+      acttable.emplace( get_self(), [&]( auto& b ) {
+         b = delta;
+         b.day = day;
+      });
+      return;
+   }
+
+   acttable.modify( slot, same_payer, [&]( auto& b ) {
+      // first touch of a new day reuses the slot of the day that fell out of the window
+      if( b.day != day ) {
+         b = activity_bucket{};
+         b.day = day;
+      }
+      b.transfers += delta.transfers;
+      b.volume    += delta.volume;
+      b.staked    += delta.staked;
+      b.unstaked  += delta.unstaked;
+      b.refunded  += delta.refunded;
    });
 }
 
 void token::unstake(name owner, asset quantity) {
    require_auth(owner);
 
+   accounts from_acnts(get_self(), owner.value);
+   unstake_from(from_acnts, owner, quantity);
+}
+
+void token::unstakemany(name owner, const std::vector<asset>& quantities) {
+   require_auth(owner);
+   check(!quantities.empty(), "no quantities to unstake");
+
+   accounts from_acnts(get_self(), owner.value);
+   for( const auto& quantity : quantities ) {
+      unstake_from(from_acnts, owner, quantity);
+   }
+}
+
+void token::unstake_from(accounts& from_acnts, const name& owner, const asset& quantity) {
    check(quantity.is_valid(), "invalid quantity");
    check(quantity.amount > 0, "must unstake positive quantity");
 
@@ -197,24 +983,52 @@ void token::unstake(name owner, asset quantity) {
 
    stats statstable( get_self(), sym_code_raw );
    const auto& st = statstable.get(sym_code_raw, "symbol does not exist");
+   check( !( st.flags.value_or() & ( flag_paused | flag_freeze_stake ) ), "staking is frozen for this symbol" );
 
-   accounts from_acnts(get_self(), owner.value);
    const auto& from = from_acnts.get(sym_code_raw, "no balance object found");
 
    check(from.staked_balance >= quantity, "overdrawn staked balance");
 
+   auto current_time = current_time_point().sec_since_epoch();
+
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   auto reward_per_share = accrue_rewards( statstable, st, totaltable );
+
+   stakestats stakestable( get_self(), sym_code_raw );
+   auto userstake = stakestable.find(owner.value);
+   if( userstake != stakestable.end() && userstake->tier.value_or() > 0 ) {
+      check( !is_locked( *userstake, current_time ), "stake is locked" );
+
+      // expired lock, drop the boost now instead of waiting for the refund
+      auto boosted_before = userstake->weight();
+      stakestable.modify(userstake, userstake->write_payer( owner ), [&]( auto& r ) {
+         settle_rewards( r, reward_per_share );
+         expire_lock( r, current_time );
+         r.boosted.value() = boosted_weight( r.staked_balance.amount, r.tier.value() );
+      });
+
+      const auto& total = totaltable.get( sym_code_raw, "token object does not exist" );
+      totaltable.modify(total, get_self(), [&]( auto& r ) {
+         r.upgrade();
+         r.boosted_total.value() -= boosted_before - userstake->boosted.value();
+      });
+   }
+
    unstakestats unstaketable( get_self(), sym_code_raw );
    auto itr = unstaketable.find(owner.value);
 
    check(itr == unstaketable.end(), "refunding request already exist");
 
-   auto current_time = current_time_point().sec_since_epoch();
    unstaketable.emplace(owner, [&]( auto& r ) {
       r.owner = owner;
       r.request_time = current_time;
       r.refund_time = current_time + st.refund_delay;
       r.amount = quantity;
    });
+
+   activity_bucket delta{};
+   delta.unstaked = quantity.amount;
+   record_activity( quantity.symbol, delta );
 }
 
 void token::refund(name owner, symbol_code& symbol) {
@@ -231,6 +1045,13 @@ void token::inline_refund(name owner, name rampayer, symbol_code& symbol) {
    check( itr -> owner == owner, "sender is not matched with owner");
    check( itr -> refund_time <= current_time_point().sec_since_epoch(), "refund is not available yet");
 
+   // a lock taken after the unstake request covers the requested tokens as well
+   stakestats staketable( get_self(), sym_code_raw );
+   auto userstake = staketable.find(owner.value);
+
+   check(userstake != staketable.end(), "user not found");
+   check( !is_locked( *userstake, current_time_point().sec_since_epoch() ), "stake is locked" );
+
    asset quantity = itr -> amount;
 
    // Modify Account Balance
@@ -239,32 +1060,46 @@ void token::inline_refund(name owner, name rampayer, symbol_code& symbol) {
    
    check( from_acnt.balance >= quantity, "overdrawn staked balance");
 
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   holder_delta holders{ st };
+   holders.stake( owner, from_acnt.staked_balance.amount, from_acnt.staked_balance.amount - quantity.amount );
+
    acnt_tbl.modify(from_acnt, rampayer, [&]( auto& a ) {
       a.staked_balance -= quantity;
    });
 
    // Modify Stake Stats
-   stakestats staketable( get_self(), sym_code_raw );
-   auto userstake = staketable.find(owner.value);
-
-   check(userstake != staketable.end(), "user not found");
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   auto reward_per_share = accrue_rewards( statstable, st, totaltable );
 
-   staketable.modify(userstake, owner, [&]( auto& r ) {
+   auto boosted_before = userstake->weight();
+   staketable.modify(userstake, userstake->write_payer( owner ), [&]( auto& r ) {
+      settle_rewards( r, reward_per_share );
       r.owner = owner;
       r.staked_balance -= quantity;
+      expire_lock( r, current_time_point().sec_since_epoch() );
+      r.boosted.value() = boosted_weight( r.staked_balance.amount, r.tier.value() );
    });
 
    // Modify Total Stake
-   staketotal totaltable( get_self(), get_first_receiver().value );
    auto total_itr = totaltable.find(sym_code_raw);
 
    check(total_itr != totaltable.end(), "symbol not found");
    
    totaltable.modify(total_itr, get_self(), [&]( auto& r ) {
+      r.upgrade();
       r.staked_balance_total -= quantity;
+      r.boosted_total.value() -= boosted_before - userstake->boosted.value();
    });
 
    unstaketable.erase(itr);
+   update_holder_stats( statstable, st, holders );
+
+   activity_bucket delta{};
+   delta.refunded = quantity.amount;
+   record_activity( quantity.symbol, delta );
 }
 
 void token::cancelrefund(name owner, symbol_code& symbol) {
@@ -282,34 +1117,156 @@ void token::cancelrefund(name owner, symbol_code& symbol) {
    unstaketable.erase(itr);
 }
 
-void token::sub_balance( const name& owner, const asset& value ) {
+bool token::is_fee_exempt( const currency_stats& st, const name& account )
+{
+   return st.fee_exempt.has_value() &&
+          std::binary_search( st.fee_exempt->begin(), st.fee_exempt->end(), account );
+}
+
+int64_t token::transfer_fee( const currency_stats& st, const name& from, const name& to, int64_t amount )
+{
+   if( !st.fee_enabled.value_or() || st.fee_ratio == 0 ) return 0;
+   if( is_fee_exempt( st, from ) || is_fee_exempt( st, to ) ) return 0;
+
+   return static_cast<int64_t>( int128_t( amount ) * st.fee_ratio / 100 );
+}
+
+int64_t token::fee_share( int64_t fee, uint64_t bps )
+{
+   return static_cast<int64_t>( int128_t( fee ) * bps / 10000 );
+}
+
+void token::route_fee( const currency_stats& st, const name& payer, int64_t fee, holder_delta& holders )
+{
+   if( fee == 0 ) return;
+
+   auto burned = fee_share( fee, st.fee_burn_bps.value_or() );
+   auto to_stakers = fee_share( fee, st.fee_stake_bps.value_or() );
+
+   // the staker share only moves the accumulator, stakers collect it with claim
+   if( to_stakers > 0 ) {
+      staketotal totaltable( get_self(), get_first_receiver().value );
+      const auto& total = totaltable.get( st.supply.symbol.code().raw(), "token object does not exist" );
+      if( total.weight() > 0 ) {
+         totaltable.modify( total, same_payer, [&]( auto& r ) {
+            r.upgrade();
+            r.reward_per_share.value() += uint128_t( to_stakers ) * reward_precision / r.boosted_total.value();
+         });
+      } else {
+         to_stakers = 0;
+      }
+   }
+
+   auto to_treasury = fee - burned - to_stakers;
+   if( to_treasury > 0 ) {
+      add_balance( st.fee_receiver, asset{ to_treasury, st.supply.symbol }, payer, holders );
+   }
+   holders.burn( burned );
+}
+
+void token::sub_balance( const name& owner, const asset& value, holder_delta& holders ) {
    accounts from_acnts( get_self(), owner.value );
    const auto& from = from_acnts.get( value.symbol.code().raw(), "no balance object found" );
 
    check( from.balance.amount >= value.amount + from.staked_balance.amount, "overdrawn balance" );
 
-   from_acnts.modify( from, owner, [&]( auto& a ) {
+   holders.balance( owner, from.balance.amount, from.balance.amount - value.amount );
+
+   // same_payer: charge debits subscribers who did not sign, and sponsored rows stay sponsored
+   from_acnts.modify( from, same_payer, [&]( auto& a ) {
          a.balance -= value;
+         // appending the field would grow the row at the expense of a payer who may not have signed
+         if( a.last_active.has_value() ) {
+            a.last_active.value() = current_time_point().sec_since_epoch();
+         }
    });
 }
 
-void token::add_balance( const name& owner, const asset& value, const name& ram_payer )
+void token::add_balance( const name& owner, const asset& value, const name& ram_payer, holder_delta& holders )
 {
    accounts to_acnts( get_self(), owner.value );
    auto to = to_acnts.find( value.symbol.code().raw() );
    if( to == to_acnts.end() ) {
-      to_acnts.emplace( ram_payer, [&]( auto& a ){
+      holders.balance( owner, 0, value.amount );
+      auto ram = sponsor_ram( ram_payer, value.symbol );
+      to_acnts.emplace( ram, [&]( auto& a ){
          a.balance = value;
          a.staked_balance = asset { 0, value.symbol };
+         a.last_active.emplace( current_time_point().sec_since_epoch() );
+         a.ram_sponsor.emplace( ram == get_self() ? ram_payer : name{} );
       });
 
    } else {
+      holders.balance( owner, to->balance.amount, to->balance.amount + value.amount );
       to_acnts.modify( to, same_payer, [&]( auto& a ) {
          a.balance += value;
       });
    }
 }
 
+void token::update_holder_stats( stats& statstable, const currency_stats& st, const holder_delta& holders )
+{
+   if( !holders.changed ) return;
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      holders.apply( s );
+   });
+}
+
+name token::sponsor_ram( const name& payer, const symbol& symbol )
+{
+   auto sym_code_raw = symbol.code().raw();
+   rampools pooltable( get_self(), sym_code_raw );
+   auto pool = pooltable.find( sym_code_raw );
+   if( pool == pooltable.end() || pool->used >= pool->capacity ) return payer;
+
+   ramusages usagetable( get_self(), sym_code_raw );
+   auto usage = usagetable.find( payer.value );
+   if( usage == usagetable.end() ) {
+      if( pool->per_account == 0 ) return payer;
+      // the pool only buys RAM for the sponsored rows, the quota row is the payer's
+      usagetable.emplace( payer, [&]( auto& u ) {
+         u.account = payer;
+         u.used = 1;
+      });
+   } else {
+      if( usage->used >= pool->per_account ) return payer;
+      usagetable.modify( usage, same_payer, [&]( auto& u ) {
+         u.used += 1;
+      });
+   }
+
+   pooltable.modify( pool, same_payer, [&]( auto& p ) {
+      p.used += 1;
+   });
+   return get_self();
+}
+
+void token::release_ram( const account& row )
+{
+   if( !row.ram_sponsor.has_value() || row.ram_sponsor.value() == name{} ) return;
+
+   auto sym_code_raw = row.balance.symbol.code().raw();
+   rampools pooltable( get_self(), sym_code_raw );
+   auto pool = pooltable.find( sym_code_raw );
+   if( pool != pooltable.end() && pool->used > 0 ) {
+      pooltable.modify( pool, same_payer, [&]( auto& p ) {
+         p.used -= 1;
+      });
+   }
+
+   ramusages usagetable( get_self(), sym_code_raw );
+   auto usage = usagetable.find( row.ram_sponsor->value );
+   if( usage == usagetable.end() ) return;
+   if( usage->used > 1 ) {
+      usagetable.modify( usage, same_payer, [&]( auto& u ) {
+         u.used -= 1;
+      });
+   } else {
+      usagetable.erase( usage );
+   }
+}
+
 void token::open( const name& owner, const symbol& symbol, const name& ram_payer )
 {
    require_auth( ram_payer );
@@ -324,21 +1281,43 @@ void token::open( const name& owner, const symbol& symbol, const name& ram_payer
    accounts acnts( get_self(), owner.value );
    auto it = acnts.find( sym_code_raw );
    if( it == acnts.end() ) {
-      acnts.emplace( ram_payer, [&]( auto& a ){
+      auto ram = sponsor_ram( ram_payer, symbol );
+      acnts.emplace( ram, [&]( auto& a ){
         a.balance = asset{0, symbol};
         a.staked_balance = asset{0, symbol};
+        a.last_active.emplace( current_time_point().sec_since_epoch() );
+        a.ram_sponsor.emplace( ram == get_self() ? ram_payer : name{} );
       });
    }
+}
 
-   stakestats stakestable( get_self(), sym_code_raw );
-   auto userstake = stakestable.find(owner.value);
+uint32_t token::openmany( const std::vector<name>& owners, const symbol& symbol, const name& ram_payer )
+{
+   require_auth( ram_payer );
 
-   if(userstake == stakestable.end()) {
-      stakestable.emplace( ram_payer, [&]( auto& r ) {
-         r.owner = owner;
-         r.staked_balance = asset{0, symbol};
+   auto sym_code_raw = symbol.code().raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+
+   uint32_t created = 0;
+   auto now = current_time_point().sec_since_epoch();
+   for( const auto& owner : owners ) {
+      check( is_account( owner ), "owner account does not exist" );
+
+      accounts acnts( get_self(), owner.value );
+      if( acnts.find( sym_code_raw ) != acnts.end() ) continue;
+
+      auto ram = sponsor_ram( ram_payer, symbol );
+      acnts.emplace( ram, [&]( auto& a ){
+        a.balance = asset{0, symbol};
+        a.staked_balance = asset{0, symbol};
+        a.last_active.emplace( now );
+        a.ram_sponsor.emplace( ram == get_self() ? ram_payer : name{} );
       });
+      ++created;
    }
+   return created;
 }
 
 void token::close( const name& owner, const symbol& symbol )
@@ -353,16 +1332,271 @@ void token::close( const name& owner, const symbol& symbol )
    check( it != acnts.end(), "Balance row already deleted or never existed. Action won't have any effect." );
    check( it->balance.amount == 0 && it->staked_balance.amount == 0, "ACCOUNTS:: Cannot close because the balance is not zero." );
 
-   acnts.erase( it );
-
    stakestats stakestable( get_self(), sym_code_raw );
    auto userstake = stakestable.find(owner.value);
 
    if(userstake != stakestable.end()) {
-      check( it -> staked_balance.amount == 0, "STAKESTATS:: Cannot close because the staked_balance is not zero." );
+      check( userstake -> staked_balance.amount == 0, "STAKESTATS:: Cannot close because the staked_balance is not zero." );
+      check( userstake -> pending_reward.value_or() == 0, "STAKESTATS:: Cannot close because the reward is not claimed." );
+   }
 
+   release_ram( *it );
+   acnts.erase( it );
+
+   if(userstake != stakestable.end()) {
       stakestable.erase(userstake);
    }
 }
 
-EOSIO_DISPATCH(token, (create)(setdelay)(settransfee)(issue)(transfer)(stake)(unstake)(refund)(cancelrefund)(open)(close)(retire))
\ No newline at end of file
+void token::reclaim( const symbol& symbol, const std::vector<name>& owners )
+{
+   check( owners.size() <= max_reclaim_batch, "too many owners in one reclaim batch" );
+
+   auto sym_code_raw = symbol.code().raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+   check( st.gc_idle.value_or() > 0, "reclaim is disabled for this symbol" );
+
+   auto now = current_time_point().sec_since_epoch();
+   stakestats stakestable( get_self(), sym_code_raw );
+   schedules scheduletable( get_self(), sym_code_raw );
+   auto to_idx = scheduletable.get_index<"byto"_n>();
+
+   // rows that are not reclaimable are skipped so a stale candidate list does not fail the batch
+   for( const auto& owner : owners ) {
+      // execute credits these rows without paying RAM, removing one would stall the payments
+      if( owner == st.fee_receiver || to_idx.find( owner.value ) != to_idx.end() ) continue;
+
+      accounts acnts( get_self(), owner.value );
+      auto it = acnts.find( sym_code_raw );
+      if( it == acnts.end() ) continue;
+      if( it->balance.amount != 0 || it->staked_balance.amount != 0 ) continue;
+      auto last_active = it->last_active.has_value() ? it->last_active.value() : st.gc_epoch.value_or();
+      if( last_active == 0 ) continue;
+      if( now < last_active || now - last_active < st.gc_idle.value() ) continue;
+
+      // the unclaimed reward lives on the stakestats row, the owner still has to claim it
+      auto userstake = stakestable.find( owner.value );
+      if( userstake != stakestable.end() && userstake->pending_reward.value_or() != 0 ) continue;
+
+      release_ram( *it );
+      acnts.erase( it );
+
+      if( userstake != stakestable.end() && userstake->staked_balance.amount == 0 ) {
+         stakestable.erase( userstake );
+      }
+   }
+}
+
+void token::importbal( const symbol& symbol, const std::vector<import_row>& rows )
+{
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+
+   importstates importtable( get_self(), sym_code_raw );
+   auto state = importtable.find( sym_code_raw );
+   if( state == importtable.end() ) {
+      state = importtable.emplace( st.issuer, [&]( auto& r ) {
+         r.sym = symbol;
+         r.cursor = name{};
+         r.imported = 0;
+         r.finalized = false;
+      });
+   }
+   check( !state->finalized, "import is already finalized" );
+
+   stakestats stakestable( get_self(), sym_code_raw );
+   staketotal totaltable( get_self(), get_first_receiver().value );
+   auto reward_per_share = accrue_rewards( statstable, st, totaltable );
+
+   auto cursor = state->cursor;
+   asset total_balance{ 0, symbol };
+   asset total_staked{ 0, symbol };
+   uint64_t imported = 0;
+   uint64_t previous = 0;
+   uint64_t total_boosted = 0;
+   holder_delta holders{ st };
+
+   for( const auto& row : rows ) {
+      check( row.owner.value > previous, "import rows must be sorted by owner" );
+      previous = row.owner.value;
+
+      // rows at or before the cursor were written by an earlier batch
+      if( row.owner.value <= cursor.value ) continue;
+
+      check( row.balance >= 0 && row.staked >= 0, "import amounts must not be negative" );
+      check( row.staked <= row.balance, "staked amount exceeds balance" );
+      check( is_account( row.owner ), "owner account does not exist" );
+
+      asset balance{ row.balance, symbol };
+      asset staked{ row.staked, symbol };
+
+      accounts acnts( get_self(), row.owner.value );
+      auto it = acnts.find( sym_code_raw );
+      if( it == acnts.end() ) {
+         holders.balance( row.owner, 0, row.balance );
+         holders.stake( row.owner, 0, row.staked );
+         acnts.emplace( st.issuer, [&]( auto& a ) {
+            a.balance = balance;
+            a.staked_balance = staked;
+            a.last_active.emplace( current_time_point().sec_since_epoch() );
+            a.ram_sponsor.emplace();
+         });
+      } else {
+         holders.balance( row.owner, it->balance.amount, it->balance.amount + row.balance );
+         holders.stake( row.owner, it->staked_balance.amount, it->staked_balance.amount + row.staked );
+         acnts.modify( it, same_payer, [&]( auto& a ) {
+            a.balance += balance;
+            a.staked_balance += staked;
+         });
+      }
+
+      if( row.staked > 0 ) {
+         auto userstake = stakestable.find( row.owner.value );
+         if( userstake == stakestable.end() ) {
+            stakestable.emplace( st.issuer, [&]( auto& r ) {
+               r.owner = row.owner;
+               r.staked_balance = staked;
+               r.tier.emplace( 0 );
+               r.unlock_time.emplace( 0 );
+               r.boosted.emplace( boosted_weight( staked.amount, 0 ) );
+               r.reward_debt.emplace( reward_per_share );
+               r.pending_reward.emplace( 0 );
+               total_boosted += r.boosted.value();
+            });
+         } else {
+            auto boosted_before = userstake->weight();
+            stakestable.modify( userstake, userstake->write_payer( st.issuer ), [&]( auto& r ) {
+               settle_rewards( r, reward_per_share );
+               r.staked_balance += staked;
+               r.boosted.value() = boosted_weight( r.staked_balance.amount, r.tier.value() );
+            });
+            total_boosted += userstake->boosted.value() - boosted_before;
+         }
+      }
+
+      total_balance += balance;
+      total_staked += staked;
+      cursor = row.owner;
+      ++imported;
+   }
+
+   if( imported == 0 ) return;
+
+   check( total_balance.amount <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply" );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.supply += total_balance;
+      holders.apply( s );
+   });
+
+   if( total_staked.amount > 0 ) {
+      auto total_itr = totaltable.find( sym_code_raw );
+
+      check( total_itr != totaltable.end(), "token object does not exist" );
+
+      totaltable.modify( total_itr, get_self(), [&]( auto& r ) {
+         r.upgrade();
+         r.staked_balance_total += total_staked;
+         r.boosted_total.value() += total_boosted;
+      });
+   }
+
+   importtable.modify( state, same_payer, [&]( auto& r ) {
+      r.cursor = cursor;
+      r.imported += imported;
+   });
+}
+
+void token::importdone( const symbol& symbol )
+{
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+
+   importstates importtable( get_self(), sym_code_raw );
+   auto state = importtable.find( sym_code_raw );
+   if( state == importtable.end() ) {
+      importtable.emplace( st.issuer, [&]( auto& r ) {
+         r.sym = symbol;
+         r.cursor = name{};
+         r.imported = 0;
+         r.finalized = true;
+      });
+   } else {
+      check( !state->finalized, "import is already finalized" );
+      importtable.modify( state, same_payer, [&]( auto& r ) {
+         r.finalized = true;
+      });
+   }
+}
+
+void token::recount( const symbol& symbol, const std::vector<name>& owners )
+{
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+   check( !st.counts_complete(), "holder counts are already complete" );
+
+   // every owner past the cursor is uncounted, so its whole row is counted now
+   auto cursor = st.counted_through.value_or();
+   holder_delta holders{ st };
+   holders.counted_through = std::numeric_limits<uint64_t>::max();
+
+   uint64_t previous = 0;
+   for( const auto& owner : owners ) {
+      check( owner.value > previous, "owners must be sorted by name" );
+      previous = owner.value;
+
+      // owners at or before the cursor were counted by an earlier batch
+      if( owner.value <= cursor ) continue;
+      cursor = owner.value;
+
+      accounts acnts( get_self(), owner.value );
+      auto it = acnts.find( sym_code_raw );
+      if( it == acnts.end() ) continue;
+
+      holders.balance( owner, 0, it->balance.amount );
+      holders.stake( owner, 0, it->staked_balance.amount );
+   }
+
+   if( cursor == st.counted_through.value_or() ) return;
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      holders.apply( s );
+      s.counted_through.value() = cursor;
+   });
+}
+
+void token::recountdone( const symbol& symbol )
+{
+   auto sym_code_raw = symbol.code().raw();
+
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+
+   require_auth( st.issuer );
+   check( st.supply.symbol == symbol, "symbol precision mismatch" );
+   check( !st.counts_complete(), "holder counts are already complete" );
+
+   statstable.modify( st, same_payer, [&]( auto& s ) {
+      s.upgrade();
+      s.counted_through.value() = std::numeric_limits<uint64_t>::max();
+   });
+}
+
+EOSIO_DISPATCH(token, (create)(setdelay)(settransfee)(setfeesplit)(setfeeexempt)(setflags)(setgcidle)(migrate)(setemission)(fundrampool)(issue)(transfer)(stake)(stakemany)(unstake)(unstakemany)(refund)(cancelrefund)(open)(openmany)(close)(retire)(importbal)(importdone)(recount)(recountdone)(stakefor)(claim)(expirelock)(reclaim)(subscribe)(unsubscribe)(charge)(swap)(swapmany)(schedule)(unschedule)(execute))
\ No newline at end of file
@@ -5,7 +5,11 @@
 #include <eosio/transaction.hpp>
 #include <eosio/time.hpp>
 
+#include <algorithm>
+#include <array>
+#include <limits>
 #include <string>
+#include <vector>
 
 namespace eosiosystem {
    class system_contract;
@@ -29,6 +33,30 @@ class [[eosio::contract("boatwingio")]] token : public contract {
    public:
       using contract::contract;
 
+      static constexpr uint8_t flag_paused           = 1 << 0;
+      static constexpr uint8_t flag_freeze_transfers = 1 << 1;
+      static constexpr uint8_t flag_freeze_stake     = 1 << 2;
+      static constexpr uint8_t flag_mask             = flag_paused | flag_freeze_transfers | flag_freeze_stake;
+
+      /**
+       * One trade for the `swapmany` action.
+       */
+      struct swap_leg {
+         name  party_a;
+         name  party_b;
+         asset a_gives;
+         asset b_gives;
+      };
+
+      /**
+       * One holder entry for the `importbal` action, amounts are in the token's precision.
+       */
+      struct import_row {
+         name    owner;
+         int64_t balance;
+         int64_t staked;
+      };
+
       /**
        * Create action.
        *
@@ -50,9 +78,131 @@ class [[eosio::contract("boatwingio")]] token : public contract {
       [[eosio::action]]
       void setdelay(const symbol& symbol, uint64_t delaytime);
 
+      /**
+       * Settransfee action.
+       *
+       * @details Sets the transfer fee of token `symbol` to `ratio` percent of each transfer,
+       * paid to `receiver` and to the shares set by `setfeesplit`. A symbol created before fees
+       * were charged keeps its stored `fee_ratio` unused until this action or `setfeesplit`
+       * runs, upgrading the contract alone does not start charging it.
+       *
+       * @param symbol - the token to configure,
+       * @param ratio - the fee in percent, at most 100,
+       * @param receiver - the account the rest of the fee goes to.
+       */
       [[eosio::action]]
       void settransfee(const symbol& symbol, uint64_t ratio, name receiver);
+
+      /**
+       * Setfeesplit action.
+       *
+       * @details Splits the transfer fee of token `symbol`: `burn_bps` of it is burned and reduces
+       * the supply, `stake_bps` of it is shared between stakers by boosted stake weight, and the
+       * rest goes to the fee receiver set by `settransfee`. Like `settransfee`, this starts
+       * charging the fee of a symbol created before fees were charged.
+       *
+       * @param symbol - the token to configure,
+       * @param burn_bps - the burned share in basis points,
+       * @param stake_bps - the stakers' share in basis points.
+       *
+       * @pre `burn_bps + stake_bps` must not exceed 10000.
+       */
+      [[eosio::action]]
+      void setfeesplit(const symbol& symbol, uint64_t burn_bps, uint64_t stake_bps);
+
+      /**
+       * Setfeeexempt action.
+       *
+       * @details Adds `account` to or removes it from the transfer fee exemption list of token
+       * `symbol`. Transfers from or to an exempt account are not charged a fee. The list is kept
+       * sorted inside the `currency_stats` row `transfer` already reads, so checking it costs a
+       * binary search and no table lookup.
+       *
+       * @param symbol - the token to configure,
+       * @param account - the account to exempt or to charge again,
+       * @param exempt - whether `account` is exempt.
+       *
+       * @pre The list holds at most `max_fee_exempt` accounts.
+       */
+      [[eosio::action]]
+      void setfeeexempt(const symbol& symbol, name account, bool exempt);
+
+      /**
+       * Setflags action.
+       *
+       * @details Sets the control flags of token `symbol` for incident response. `flag_paused`
+       * stops transfers and staking, `flag_freeze_transfers` stops transfers only and
+       * `flag_freeze_stake` stops `stake` and `unstake` only. The flags live in the
+       * `currency_stats` row those actions already read, so checking them costs no table read.
+       *
+       * @param symbol - the token to configure,
+       * @param flags - the new flags, a combination of `flag_paused`, `flag_freeze_transfers` and `flag_freeze_stake`.
+       */
+      [[eosio::action]]
+      void setflags(const symbol& symbol, uint8_t flags);
+
+      /**
+       * Setgcidle action.
+       *
+       * @details Sets how long, in seconds, an empty `accounts` row of token `symbol` must stay
+       * untouched before anyone can remove it with `reclaim`. Zero disables `reclaim`. The
+       * first call also records the time that rows written before activity was tracked count
+       * as last active at.
+       *
+       * @param symbol - the token to configure,
+       * @param idletime - the idle time in seconds.
+       */
+      [[eosio::action]]
+      void setgcidle(const symbol& symbol, uint64_t idletime);
+
+      /**
+       * Migrate action.
+       *
+       * @details Rewrites the `currency_stats` and `totalstake` rows of token `symbol` with every
+       * field added since the first release. Rows are also upgraded by the first write that touches them, this
+       * lets the issuer do it up front, before any new field is configured. It does not start
+       * charging the transfer fee, see `settransfee`.
+       *
+       * @param symbol - the token to migrate.
+       */
+      [[eosio::action]]
+      void migrate(const symbol& symbol);
       
+      /**
+       * Setemission action.
+       *
+       * @details Sets the continuous emission of token `symbol` to `rate` tokens per second, in the
+       * token's smallest unit. Emission accrues lazily: whenever a stake related action runs, the
+       * supply is brought up to date for the elapsed time, bounded by `max_supply`, and the newly
+       * minted tokens are shared between stakers by boosted stake weight. Stakers collect them
+       * with `claim`.
+       *
+       * @param symbol - the token to configure,
+       * @param rate - the emission in the token's smallest unit per second, zero stops emission.
+       */
+      [[eosio::action]]
+      void setemission(const symbol& symbol, uint64_t rate);
+
+      /**
+       * Fundrampool action.
+       *
+       * @details Allows the issuer of token `symbol` to fund a RAM pool that pays for first-time
+       * `accounts` rows instead of the sender or `ram_payer`. The issuer buys RAM for `rows` rows
+       * for the contract account and raises the pool's capacity by `rows`. A sponsored row
+       * removed by `close` or `reclaim` gives its slot back to the pool and to its payer's quota,
+       * the payer pays for the small row that tracks that quota.
+       *
+       * The RAM is bought with the issuer's `rampool` permission. The issuer creates it with the
+       * contract account's `eosio.code` permission as its only authority and links it to
+       * `eosio::buyrambytes` alone, so the contract cannot act with any other authority of the issuer.
+       *
+       * @param symbol - the token the pool sponsors rows for,
+       * @param rows - the number of rows to add to the pool's capacity,
+       * @param per_account - the maximum number of rows sponsored on behalf of a single payer.
+       */
+      [[eosio::action]]
+      void fundrampool(const symbol& symbol, uint64_t rows, uint64_t per_account);
+
       /**
        * Issue action.
        *
@@ -81,7 +231,8 @@ class [[eosio::contract("boatwingio")]] token : public contract {
        * Transfer action.
        *
        * @details Allows `from` account to transfer to `to` account the `quantity` tokens.
-       * One account is debited and the other is credited with quantity tokens.
+       * One account is debited with quantity tokens and the other is credited with quantity tokens
+       * less the transfer fee, which is routed as configured by `settransfee` and `setfeesplit`.
        *
        * @param from - the account to transfer from,
        * @param to - the account to be transferred to,
@@ -94,21 +245,178 @@ class [[eosio::contract("boatwingio")]] token : public contract {
                      const asset&   quantity,
                      const string&  memo );
 
+      /**
+       * Schedule action.
+       *
+       * @details Allows `from` account to schedule `count` transfers of `quantity` tokens to `to`
+       * account, the first one due at `first_due` and the rest every `interval` seconds after it.
+       * The total of all payments is debited from `from` up front and reserved for the schedule,
+       * and `from` pays the RAM of the recipient's balance row if it does not exist yet. The
+       * transfer fee is charged on each payment when it is made, see `execute`.
+       *
+       * @param from - the account to transfer from,
+       * @param to - the account to be transferred to,
+       * @param quantity - the quantity of tokens paid on each due time,
+       * @param interval - the seconds between two payments,
+       * @param first_due - the time of the first payment, in seconds since epoch,
+       * @param count - the number of payments.
+       */
+      [[eosio::action]]
+      void schedule( const name&    from,
+                     const name&    to,
+                     const asset&   quantity,
+                     uint64_t       interval,
+                     uint64_t       first_due,
+                     uint64_t       count );
+
+      /**
+       * Unschedule action.
+       *
+       * @details Cancels schedule `id` of `from` account and returns the reserved amount of
+       * the payments not yet made.
+       *
+       * @param from - the account that created the schedule,
+       * @param symbol - the token of the schedule,
+       * @param id - the id of the schedule.
+       */
+      [[eosio::action]]
+      void unschedule( const name& from, const symbol& symbol, uint64_t id );
+
+      /**
+       * Execute action.
+       *
+       * @details Permissionless keeper crank, pays up to `max_count` due scheduled transfers of
+       * token `symbol` in order of their due time. The crank never pays RAM and notifies no one.
+       * Nothing is paid while the symbol is frozen with `flag_paused` or `flag_freeze_transfers`.
+       * A payment whose recipient has no balance row, or that owes a transfer fee while the fee
+       * receiver has none, stays due and is paid by a later crank once the row exists. Such
+       * entries do not count against `max_count`, at most `max_execute_skips` are passed over.
+       *
+       * @param symbol - the token to pay scheduled transfers of,
+       * @param max_count - the maximum number of payments to make, at most `max_execute_batch`.
+       */
+      [[eosio::action]]
+      void execute( const symbol& symbol, uint64_t max_count );
+
+      /**
+       * Subscribe action.
+       *
+       * @details Allows `subscriber` to grant `merchant` the right to charge `quantity` tokens
+       * once every `period` seconds with the `charge` action. Subscribing again to the
+       * same merchant replaces the grant.
+       *
+       * @param subscriber - the account to be charged,
+       * @param merchant - the account allowed to charge,
+       * @param quantity - the quantity of tokens charged per period,
+       * @param period - the length of a period in seconds.
+       */
+      [[eosio::action]]
+      void subscribe( const name&    subscriber,
+                      const name&    merchant,
+                      const asset&   quantity,
+                      uint64_t       period );
+
+      /**
+       * Unsubscribe action.
+       *
+       * @details Revokes the grant `subscriber` gave to `merchant`.
+       *
+       * @param subscriber - the account that granted the subscription,
+       * @param merchant - the account the subscription was granted to.
+       */
+      [[eosio::action]]
+      void unsubscribe( const name& subscriber, const name& merchant );
+
+      /**
+       * Charge action.
+       *
+       * @details Allows `merchant` to bill each of `subscribers` for the current period. Subscribers
+       * already charged within their period are skipped, as are those without a subscription, a
+       * balance row or enough unstaked balance, and those whose payment would not cover the
+       * transfer fee. Each payment is charged the transfer fee, the merchant receives the rest.
+       *
+       * @param merchant - the account that is paid,
+       * @param subscribers - the subscribers to charge.
+       */
+      [[eosio::action]]
+      void charge( const name& merchant, const std::vector<name>& subscribers );
+
       /**
        * Stake action.
        * 
-       * @details User stakes their tokens.
+       * @details User stakes their tokens, optionally locking the whole stake for the duration
+       *          of `tier` in exchange for a boosted stake weight, see `lock_tiers`. Staking with
+       *          an equal or longer tier relocks the whole stake from now, a shorter tier joins
+       *          the active lock. A locked stake cannot be unstaked or refunded before it unlocks.
        * 
        * @param owner - the account to stake,
-       * @param quantity - the quantity of tokens to be staked.
+       * @param quantity - the quantity of tokens to be staked,
+       * @param tier - the lock tier, 0 for no lock. Optional so that clients built for the
+       *               two-argument action keep working.
+       */
+      [[eosio::action]]
+      void stake(name owner, asset quantity, eosio::binary_extension<uint8_t> tier);
+
+      /**
+       * Stakemany action.
+       *
+       * @details Stakes several tokens of `owner` in one action, one entry of `quantities` per stake.
+       *
+       * @param owner - the account to stake,
+       * @param quantities - the quantities of tokens to be staked,
+       * @param tier - the lock tier applied to every stake, 0 for no lock.
+       */
+      [[eosio::action]]
+      void stakemany(name owner, const std::vector<asset>& quantities, uint8_t tier);
+
+      /**
+       * Stakefor action.
+       *
+       * @details Allows `from` account to transfer `quantity` tokens to `to` account and stake
+       * them on behalf of `to` in the same action. The recipient's balance and staked balance
+       * are credited together and no authorization from `to` is required. The transfer fee is
+       * charged as for `transfer`, `to` receives and stakes the rest.
+       *
+       * @param from - the account to transfer from,
+       * @param to - the account to be transferred to and staked for,
+       * @param quantity - the quantity of tokens to be transferred and staked,
+       * @param memo - the memo string to accompany the transaction.
+       */
+      [[eosio::action]]
+      void stakefor( const name&    from,
+                     const name&    to,
+                     const asset&   quantity,
+                     const string&  memo );
+
+      /**
+       * Claim action.
+       *
+       * @details Credits `owner` with the staking rewards of token `symbol` accrued so far. An
+       * expired lock falls back to tier 0 and stops boosting the stake weight.
+       *
+       * @param owner - the staker to pay,
+       * @param symbol - the token to claim rewards for.
        */
       [[eosio::action]]
-      void stake(name owner, asset quantity);
+      void claim(name owner, const symbol& symbol);
+
+      /**
+       * Expirelock action.
+       *
+       * @details Permissionless, drops the expired lock of `owner` on token `symbol` back to
+       * tier 0 so that a lapsed boost stops diluting the other stakers' rewards. The rewards
+       * earned with the boost until now stay with `owner`.
+       *
+       * @param owner - the staker whose lock has expired,
+       * @param symbol - the staked token.
+       */
+      [[eosio::action]]
+      void expirelock(name owner, const symbol& symbol);
 
       /**
        * Unstake action
        * 
-       * @details User unstakes theis tokens.
+       * @details User unstakes theis tokens. Fails while the stake is locked.
        * 
        * @param owner - the account to unstake,
        * @param quantity - the quantity of tokens to be unstaked.
@@ -116,6 +424,17 @@ class [[eosio::contract("boatwingio")]] token : public contract {
       [[eosio::action]]
       void unstake(name owner, asset quantity);
    
+      /**
+       * Unstakemany action
+       * 
+       * @details Unstakes several tokens of `owner` in one action, one entry of `quantities` per unstake.
+       * 
+       * @param owner - the account to unstake,
+       * @param quantities - the quantities of tokens to be unstaked.
+       */
+      [[eosio::action]]
+      void unstakemany(name owner, const std::vector<asset>& quantities);
+
       /**
        * Refund action
        * 
@@ -125,6 +444,7 @@ class [[eosio::contract("boatwingio")]] token : public contract {
        * @param index - index of refund request.
        * 
        * @pre There should be refund requests in the refund data table.
+       * @pre The stake must not be locked, see `stake`.
        * @pre Index should be designated by user.
        */
       [[eosio::action]]
@@ -145,7 +465,8 @@ class [[eosio::contract("boatwingio")]] token : public contract {
        * Open action.
        *
        * @details Allows `ram_payer` to create an account `owner` with zero balance for
-       * token `symbol` at the expense of `ram_payer`.
+       * token `symbol` at the expense of `ram_payer`. The `stakestats` row is not created here,
+       * `stake` creates it on first use so holders who never stake do not pay for it.
        *
        * @param owner - the account to be created,
        * @param symbol - the token to be payed with by `ram_payer`,
@@ -157,6 +478,21 @@ class [[eosio::contract("boatwingio")]] token : public contract {
       [[eosio::action]]
       void open( const name& owner, const symbol& symbol, const name& ram_payer );
 
+      /**
+       * Openmany action.
+       *
+       * @details Batch form of `open`, creates zero balance rows of token `symbol` for every
+       * account of `owners` that does not have one yet, at the expense of `ram_payer`.
+       *
+       * @param owners - the accounts to be created,
+       * @param symbol - the token to be payed with by `ram_payer`,
+       * @param ram_payer - the account that supports the cost of this action.
+       *
+       * @return the number of rows created, owners that already had a row are skipped.
+       */
+      [[eosio::action]]
+      uint32_t openmany( const std::vector<name>& owners, const symbol& symbol, const name& ram_payer );
+
       /**
        * Close action.
        *
@@ -167,11 +503,110 @@ class [[eosio::contract("boatwingio")]] token : public contract {
        * @param symbol - the symbol of the token to execute the close action for.
        *
        * @pre The pair of owner plus symbol has to exist otherwise no action is executed,
-       * @pre If the pair of owner plus symbol exists, the balance has to be zero.
+       * @pre If the pair of owner plus symbol exists, the balance has to be zero,
+       * @pre Any staking reward of `owner` for `symbol` has to be claimed.
        */
       [[eosio::action]]
       void close( const name& owner, const symbol& symbol );
 
+      /**
+       * Reclaim action.
+       *
+       * @details Permissionless cleanup of abandoned rows. For each of `owners`, erases the
+       * `accounts` row of token `symbol` and the matching `stakestats` row when the balance and
+       * staked balance are zero, no staking reward is left to claim and the row has been idle
+       * for at least the symbol's `gc_idle`.
+       * Rows last written before activity was tracked count as last active when `setgcidle` was
+       * first called. The RAM goes back to whoever paid for the rows. Owners whose rows do not
+       * qualify are skipped, as are the fee receiver and recipients of a pending scheduled transfer.
+       *
+       * @param symbol - the token to reclaim rows for,
+       * @param owners - the candidate owners, at most `max_reclaim_batch` of them.
+       */
+      [[eosio::action]]
+      void reclaim( const symbol& symbol, const std::vector<name>& owners );
+
+      /**
+       * Swap action.
+       *
+       * @details Delivery versus payment between two symbols. `party_a` pays `a_gives` to `party_b`
+       * and `party_b` pays `b_gives` to `party_a` atomically, both parties have to authorize.
+       * Each side is charged the transfer fee of its symbol, the counterparty receives the rest.
+       *
+       * @param party_a - the first party of the trade,
+       * @param party_b - the second party of the trade,
+       * @param a_gives - the quantity `party_a` delivers,
+       * @param b_gives - the quantity `party_b` delivers.
+       */
+      [[eosio::action]]
+      void swap( const name&    party_a,
+                 const name&    party_b,
+                 const asset&   a_gives,
+                 const asset&   b_gives );
+
+      /**
+       * Swapmany action.
+       *
+       * @details Settles several matched trades in one action, see `swap`.
+       *
+       * @param legs - the trades to settle.
+       */
+      [[eosio::action]]
+      void swapmany( const std::vector<swap_leg>& legs );
+
+      /**
+       * Importbal action.
+       *
+       * @details Allows the issuer to migrate holders of an existing token in bulk. Each row
+       * is written straight into `accounts`, `stakestats` and the aggregates, with a single
+       * supply check for the whole batch. Rows must be sorted by owner; rows at or before
+       * the saved cursor are skipped so an interrupted import can be resubmitted.
+       *
+       * @param symbol - the token to import balances for,
+       * @param rows - the holders to import, sorted by ascending owner.
+       *
+       * @pre `importdone` has not been executed for `symbol`,
+       * @pre Each row has `0 <= staked <= balance`.
+       */
+      [[eosio::action]]
+      void importbal( const symbol& symbol, const std::vector<import_row>& rows );
+
+      /**
+       * Importdone action.
+       *
+       * @details Finalizes the import for token `symbol`, `importbal` is disabled for good afterwards.
+       *
+       * @param symbol - the token to finalize the import for.
+       */
+      [[eosio::action]]
+      void importdone( const symbol& symbol );
+
+      /**
+       * Recount action.
+       *
+       * @details Backfills the holder counts of token `symbol` for owners whose rows predate the
+       * counts. Until `recountdone` the counts cover only the owners up to the saved cursor, and
+       * changes to the rows of later owners are left out. Each listed owner's current balance
+       * and stake are added. Owners must be sorted, and owners at or before the cursor are
+       * skipped so an interrupted recount can be resubmitted.
+       *
+       * @param symbol - the token to recount,
+       * @param owners - every owner with a balance row, in batches sorted by ascending name.
+       */
+      [[eosio::action]]
+      void recount( const symbol& symbol, const std::vector<name>& owners );
+
+      /**
+       * Recountdone action.
+       *
+       * @details Marks the holder counts of token `symbol` complete. Changes to every owner's row
+       * are counted from then on.
+       *
+       * @param symbol - the token to finalize the recount for.
+       */
+      [[eosio::action]]
+      void recountdone( const symbol& symbol );
+
       /**
        * Get supply method.
        *
@@ -209,20 +644,78 @@ class [[eosio::contract("boatwingio")]] token : public contract {
       using retire_action = eosio::action_wrapper<"retire"_n, &token::retire>;
       using transfer_action = eosio::action_wrapper<"transfer"_n, &token::transfer>;
       using open_action = eosio::action_wrapper<"open"_n, &token::open>;
+      using openmany_action = eosio::action_wrapper<"openmany"_n, &token::openmany>;
       using close_action = eosio::action_wrapper<"close"_n, &token::close>;
       using setdelay_action = eosio::action_wrapper<"setdelay"_n, &token::setdelay>;
       using settransfee_action = eosio::action_wrapper<"settransfee"_n, &token::settransfee>;
+      using setfeesplit_action = eosio::action_wrapper<"setfeesplit"_n, &token::setfeesplit>;
+      using setfeeexempt_action = eosio::action_wrapper<"setfeeexempt"_n, &token::setfeeexempt>;
+      using setflags_action = eosio::action_wrapper<"setflags"_n, &token::setflags>;
+      using setgcidle_action = eosio::action_wrapper<"setgcidle"_n, &token::setgcidle>;
+      using migrate_action = eosio::action_wrapper<"migrate"_n, &token::migrate>;
+      using setemission_action = eosio::action_wrapper<"setemission"_n, &token::setemission>;
+      using fundrampool_action = eosio::action_wrapper<"fundrampool"_n, &token::fundrampool>;
+      using subscribe_action = eosio::action_wrapper<"subscribe"_n, &token::subscribe>;
+      using unsubscribe_action = eosio::action_wrapper<"unsubscribe"_n, &token::unsubscribe>;
+      using charge_action = eosio::action_wrapper<"charge"_n, &token::charge>;
+      using schedule_action = eosio::action_wrapper<"schedule"_n, &token::schedule>;
+      using unschedule_action = eosio::action_wrapper<"unschedule"_n, &token::unschedule>;
+      using execute_action = eosio::action_wrapper<"execute"_n, &token::execute>;
       using stake_action = eosio::action_wrapper<"stake"_n, &token::stake>;
+      using stakemany_action = eosio::action_wrapper<"stakemany"_n, &token::stakemany>;
+      using stakefor_action = eosio::action_wrapper<"stakefor"_n, &token::stakefor>;
+      using claim_action = eosio::action_wrapper<"claim"_n, &token::claim>;
+      using expirelock_action = eosio::action_wrapper<"expirelock"_n, &token::expirelock>;
       using unstake_action = eosio::action_wrapper<"unstake"_n, &token::unstake>;
+      using unstakemany_action = eosio::action_wrapper<"unstakemany"_n, &token::unstakemany>;
       using refund_action = eosio::action_wrapper<"refund"_n, &token::refund>;
       using cancelrefund_action = eosio::action_wrapper<"cancelrefund"_n, &token::cancelrefund>;
+      using swap_action = eosio::action_wrapper<"swap"_n, &token::swap>;
+      using swapmany_action = eosio::action_wrapper<"swapmany"_n, &token::swapmany>;
+      using reclaim_action = eosio::action_wrapper<"reclaim"_n, &token::reclaim>;
+      using importbal_action = eosio::action_wrapper<"importbal"_n, &token::importbal>;
+      using importdone_action = eosio::action_wrapper<"importdone"_n, &token::importdone>;
+      using recount_action = eosio::action_wrapper<"recount"_n, &token::recount>;
+      using recountdone_action = eosio::action_wrapper<"recountdone"_n, &token::recountdone>;
 
       // ... END OF PUBLIC
 
    private:
+      static constexpr size_t max_reclaim_batch = 100;
+      static constexpr uint64_t max_execute_batch = 100;
+      // due entries `execute` may pass over in one call, on top of the payments it makes
+      static constexpr uint64_t max_execute_skips = 100;
+      // keeps the stats row, which every transfer reads, small
+      static constexpr size_t max_fee_exempt = 64;
+      static constexpr uint32_t seconds_per_day = 24 * 3600;
+      static constexpr uint32_t activity_days = 90;
+      struct lock_tier {
+         uint32_t days;
+         uint32_t multiplier; // stake weight in basis points
+      };
+      // an expired lock falls back to tier 0 the next time its row is touched or `expirelock` runs
+      static constexpr std::array<lock_tier, 4> lock_tiers{{
+         { 0, 10000 }, { 30, 12500 }, { 90, 15000 }, { 365, 20000 }
+      }};
+
+      // fixed point scale of `stake_total::reward_per_share`
+      static constexpr uint128_t reward_precision = 1'000'000'000'000;
+
+      // decimal digits of the largest asset amount, 2^62 - 1
+      static constexpr uint32_t balance_buckets = 19;
+      // RAM bought per sponsored row: an `accounts` row with its row overhead, about 152 bytes,
+      // plus the table entry of the owner's scope, about 108 bytes, which a first-time holder adds
+      static constexpr uint64_t sponsored_row_bytes = 260;
+      // issuer permission `fundrampool` buys RAM with, linked to `eosio::buyrambytes` only
+      static constexpr name rampool_permission = "rampool"_n;
+
       struct [[eosio::table]] account {
          asset    balance;
          asset staked_balance;
+         // appended after the first release, a row without it is never idle
+         eosio::binary_extension<uint32_t> last_active;
+         // the payer whose `ram_pool` quota paid for the row, empty when the row is not sponsored
+         eosio::binary_extension<name> ram_sponsor;
 
          uint64_t primary_key()const { return balance.symbol.code().raw(); }
       };
@@ -234,21 +727,173 @@ class [[eosio::contract("boatwingio")]] token : public contract {
          uint64_t refund_delay;
          uint64_t fee_ratio;
          name fee_receiver;
+         // fields below were appended after the first release, rows written before lack them
+         eosio::binary_extension<uint64_t> gc_idle;
+         eosio::binary_extension<uint64_t> holders;
+         eosio::binary_extension<uint64_t> stakers;
+         eosio::binary_extension<std::vector<uint64_t>> balance_histogram;
+         eosio::binary_extension<uint64_t> emission_rate;
+         eosio::binary_extension<uint32_t> last_emission;
+         eosio::binary_extension<uint64_t> fee_burn_bps;
+         eosio::binary_extension<uint64_t> fee_stake_bps;
+         eosio::binary_extension<std::vector<name>> fee_exempt;
+         eosio::binary_extension<uint8_t> flags;
+         // holders, stakers and balance_histogram cover the owners up to this name, see `recount`
+         eosio::binary_extension<uint64_t> counted_through;
+         // rows written before `last_active` existed count as last active at this time, see `reclaim`
+         eosio::binary_extension<uint32_t> gc_epoch;
+         // the release before fee splits stored `fee_ratio` without charging it, fees start once
+         // the issuer confirms them with `settransfee` or `setfeesplit`
+         eosio::binary_extension<bool> fee_enabled;
 
          uint64_t primary_key()const { return supply.symbol.code().raw(); }
+
+         // whether the holder counts cover every owner
+         bool counts_complete() const { return counted_through.value_or() == std::numeric_limits<uint64_t>::max(); }
+
+         /**
+          * Fills every missing extension with its default. An extension is only read back
+          * when all the ones before it were written, so each write to the row upgrades it first.
+          */
+         void upgrade() {
+            if( !gc_idle.has_value() ) gc_idle.emplace( 0 );
+            if( !holders.has_value() ) holders.emplace( 0 );
+            if( !stakers.has_value() ) stakers.emplace( 0 );
+            if( !balance_histogram.has_value() ) balance_histogram.emplace( balance_buckets, 0 );
+            if( !emission_rate.has_value() ) emission_rate.emplace( 0 );
+            if( !last_emission.has_value() ) last_emission.emplace( 0 );
+            if( !fee_burn_bps.has_value() ) fee_burn_bps.emplace( 0 );
+            if( !fee_stake_bps.has_value() ) fee_stake_bps.emplace( 0 );
+            if( !fee_exempt.has_value() ) fee_exempt.emplace();
+            if( !flags.has_value() ) flags.emplace( 0 );
+            // the rows of a symbol from before the counts existed were never counted
+            if( !counted_through.has_value() ) counted_through.emplace( 0 );
+            if( !gc_epoch.has_value() ) gc_epoch.emplace( 0 );
+            if( !fee_enabled.has_value() ) fee_enabled.emplace( false );
+         }
+      };
+
+      /**
+       * Holder count and burned supply changes collected while an action moves balances, applied
+       * to `currency_stats` once at the end of the action and only when something changed.
+       * `balance_histogram[i]` counts holders whose balance has `i + 1` decimal digits. Changes of
+       * owners past `counted_through` are dropped, `recount` counts those owners later.
+       */
+      struct holder_delta {
+         int64_t holders = 0;
+         int64_t stakers = 0;
+         std::array<int64_t, balance_buckets> buckets{};
+         int64_t burned = 0;
+         bool changed = false;
+         uint64_t counted_through;
+
+         explicit holder_delta( const currency_stats& st ) : counted_through( st.counted_through.value_or() ) {}
+
+         static uint32_t bucket( int64_t amount ) {
+            uint32_t b = 0;
+            while( amount >= 10 ) {
+               amount /= 10;
+               ++b;
+            }
+            return b;
+         }
+
+         void balance( const name& owner, int64_t before, int64_t after ) {
+            if( owner.value > counted_through ) return;
+            if( before > 0 && after > 0 && bucket( before ) == bucket( after ) ) return;
+            if( before > 0 ) {
+               --buckets[ bucket( before ) ];
+               if( after == 0 ) --holders;
+            }
+            if( after > 0 ) {
+               ++buckets[ bucket( after ) ];
+               if( before == 0 ) ++holders;
+            }
+            changed = changed || before != after;
+         }
+
+         void stake( const name& owner, int64_t before, int64_t after ) {
+            if( owner.value > counted_through ) return;
+            if( (before > 0) == (after > 0) ) return;
+            stakers += after > 0 ? 1 : -1;
+            changed = true;
+         }
+
+         void burn( int64_t amount ) {
+            burned += amount;
+            changed = changed || amount > 0;
+         }
+
+         // a count that went under zero was never complete, e.g. after an early `recountdone`,
+         // so it stops at zero instead of wrapping around
+         static void add_count( uint64_t& count, int64_t delta ) {
+            if( delta < 0 && count < uint64_t( -delta ) ) {
+               count = 0;
+            } else {
+               count += delta;
+            }
+         }
+
+         void apply( currency_stats& s ) const {
+            s.upgrade();
+            s.supply.amount -= burned;
+            add_count( s.holders.value(), holders );
+            add_count( s.stakers.value(), stakers );
+            auto& histogram = s.balance_histogram.value();
+            histogram.resize( balance_buckets );
+            for( uint32_t i = 0; i < balance_buckets; ++i ) {
+               add_count( histogram[i], buckets[i] );
+            }
+         }
       };
 
       struct [[eosio::table]] stake_stats {
          name owner;
          asset staked_balance;
+         // fields below were appended after the first release, rows written before lack them
+         eosio::binary_extension<uint8_t> tier;
+         eosio::binary_extension<uint32_t> unlock_time;
+         eosio::binary_extension<uint64_t> boosted;
+         eosio::binary_extension<uint128_t> reward_debt;
+         eosio::binary_extension<int64_t> pending_reward;
 
          uint64_t primary_key() const { return owner.value; }
+
+         // rows from before lock tiers are unlocked, so they weigh exactly their stake
+         uint64_t weight() const { return boosted.has_value() ? boosted.value() : staked_balance.amount; }
+
+         /**
+          * Payer for a write by `signer`. Upgrading grows the row, which only an account that
+          * signed may pay for, a row that is already upgraded keeps its payer.
+          */
+         name write_payer( const name& signer ) const { return pending_reward.has_value() ? same_payer : signer; }
+
+         // see `currency_stats::upgrade`
+         void upgrade() {
+            if( !tier.has_value() ) tier.emplace( 0 );
+            if( !unlock_time.has_value() ) unlock_time.emplace( 0 );
+            if( !boosted.has_value() ) boosted.emplace( staked_balance.amount );
+            if( !reward_debt.has_value() ) reward_debt.emplace( 0 );
+            if( !pending_reward.has_value() ) pending_reward.emplace( 0 );
+         }
       };
 
       struct [[eosio::table]] stake_total {
          asset staked_balance_total;
+         // fields below were appended after the first release, rows written before lack them
+         eosio::binary_extension<uint64_t> boosted_total;
+         eosio::binary_extension<uint128_t> reward_per_share;
 
          uint64_t primary_key() const { return staked_balance_total.symbol.code().raw(); }
+
+         // see `stake_stats::weight`
+         uint64_t weight() const { return boosted_total.has_value() ? boosted_total.value() : staked_balance_total.amount; }
+
+         // see `currency_stats::upgrade`
+         void upgrade() {
+            if( !boosted_total.has_value() ) boosted_total.emplace( staked_balance_total.amount );
+            if( !reward_per_share.has_value() ) reward_per_share.emplace( 0 );
+         }
       };
 
       struct [[eosio::table]] unstake_stats {
@@ -263,15 +908,126 @@ class [[eosio::contract("boatwingio")]] token : public contract {
          uint64_t primary_key() const { return owner.value; }
       };
 
+      struct [[eosio::table]] import_state {
+         symbol   sym;
+         name     cursor;
+         uint64_t imported;
+         bool     finalized;
+
+         uint64_t primary_key() const { return sym.code().raw(); }
+      };
+
+      struct [[eosio::table]] ram_pool {
+         symbol   sym;
+         uint64_t capacity;
+         uint64_t used;
+         uint64_t per_account;
+
+         uint64_t primary_key() const { return sym.code().raw(); }
+      };
+
+      struct [[eosio::table]] ram_usage {
+         name     account;
+         uint64_t used;
+
+         uint64_t primary_key() const { return account.value; }
+      };
+
+      struct [[eosio::table]] scheduled_transfer {
+         uint64_t id;
+         name     from;
+         name     to;
+         asset    amount;
+         uint64_t interval;
+         uint64_t next_due;
+         uint64_t remaining;
+
+         uint64_t primary_key() const { return id; }
+         uint64_t by_due() const { return next_due; }
+         uint64_t by_to() const { return to.value; }
+      };
+
+      /**
+       * Transfers of one symbol made by a batch action, flushed to the symbol's stats and
+       * activity rows once at the end of the action. The fees they owe are routed at the flush
+       * as well, with `fee_payer`, who signed the action, paying for a new fee receiver row.
+       */
+      struct symbol_transfers {
+         asset          quantity;
+         uint32_t       transfers;
+         holder_delta   holders;
+         currency_stats stats;
+         int64_t        fees;
+         name           fee_payer;
+      };
+
+      struct [[eosio::table]] subscription {
+         name     subscriber;
+         asset    amount;
+         uint64_t period;
+         uint64_t last_charged;
+
+         uint64_t primary_key() const { return subscriber.value; }
+      };
+
+      /**
+       * Activity of one symbol on `day`, stored in slot `day % activity_days` of the symbol's
+       * scope. A slot whose `day` is older than the window is stale and reads as empty, the
+       * first write of a new day reuses it.
+       */
+      struct [[eosio::table]] activity_bucket {
+         uint32_t day;
+         uint32_t transfers;
+         int64_t  volume;
+         int64_t  staked;
+         int64_t  unstaked;
+         int64_t  refunded;
+
+         uint64_t primary_key() const { return day % activity_days; }
+      };
+
       typedef eosio::multi_index< "accounts"_n, account > accounts;
       typedef eosio::multi_index< "stat"_n, currency_stats > stats;
       typedef eosio::multi_index< "stakestats"_n, stake_stats > stakestats;
       typedef eosio::multi_index< "totalstake"_n, stake_total > staketotal;
       typedef eosio::multi_index< "unstakestats"_n, unstake_stats > unstakestats;
+      typedef eosio::multi_index< "importstate"_n, import_state > importstates;
+      typedef eosio::multi_index< "rampool"_n, ram_pool > rampools;
+      typedef eosio::multi_index< "ramusage"_n, ram_usage > ramusages;
+      typedef eosio::multi_index< "schedules"_n, scheduled_transfer,
+         indexed_by< "bydue"_n, const_mem_fun< scheduled_transfer, uint64_t, &scheduled_transfer::by_due > >,
+         indexed_by< "byto"_n, const_mem_fun< scheduled_transfer, uint64_t, &scheduled_transfer::by_to > >
+      > schedules;
+      typedef eosio::multi_index< "activity"_n, activity_bucket > activitytable;
+      typedef eosio::multi_index< "subs"_n, subscription > subscriptions;
 
-      void sub_balance( const name& owner, const asset& value );
-      void add_balance( const name& owner, const asset& value, const name& ram_payer );
+      void sub_balance( const name& owner, const asset& value, holder_delta& holders );
+      void add_balance( const name& owner, const asset& value, const name& ram_payer, holder_delta& holders );
+      static bool is_fee_exempt( const currency_stats& st, const name& account );
+      static int64_t transfer_fee( const currency_stats& st, const name& from, const name& to, int64_t amount );
+      static int64_t fee_share( int64_t fee, uint64_t bps );
+      void route_fee( const currency_stats& st, const name& payer, int64_t fee, holder_delta& holders );
+      void update_holder_stats( stats& statstable, const currency_stats& st, const holder_delta& holders );
+      symbol_transfers& transfers_for( std::vector<symbol_transfers>& totals, const symbol& symbol );
+      void flush_transfers( std::vector<symbol_transfers>& totals );
+      void settle_swap( const swap_leg& leg, std::vector<symbol_transfers>& totals );
+      void stake_from( accounts& from_acnts, staketotal& totaltable, const name& owner, const asset& quantity, uint8_t tier );
+      void unstake_from( accounts& from_acnts, const name& owner, const asset& quantity );
+      void add_stake( stats& statstable, const currency_stats& st, staketotal& totaltable,
+                      const name& owner, const asset& quantity, const name& ram_payer, uint8_t tier );
+      static uint64_t boosted_weight( int64_t amount, uint8_t tier );
+      static void expire_lock( stake_stats& r, uint32_t now );
+      static bool is_locked( const stake_stats& r, uint32_t now );
+      static void settle_rewards( stake_stats& r, uint128_t reward_per_share );
+      static int64_t pending_emission( const currency_stats& st, uint64_t weight, uint32_t now );
+      uint128_t accrue_rewards( stats& statstable, const currency_stats& st, staketotal& totaltable );
+      name sponsor_ram( const name& payer, const symbol& symbol );
+      void release_ram( const account& row );
+      void record_activity( const symbol& symbol, const activity_bucket& delta );
       void inline_refund( name owner, name rampayer, symbol_code& symbol);
       asset collect_refund( name owner, const symbol& symbol );
+
+      // the native unit tests in tests/ reach the static helpers above through it
+      friend struct token_tester;
 };
 /** @}*/ // end of @defgroup eosiotoken eosio.token
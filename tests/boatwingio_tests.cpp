@@ -0,0 +1,214 @@
+#include <eosio/tester.hpp>
+
+#include <boatwingio.hpp>
+
+#include <cstring>
+
+/**
+ * Reaches the private static helpers of `token`, which hold the fee, lock and emission math that
+ * the actions apply to their table rows.
+ */
+struct token_tester {
+   using currency_stats = token::currency_stats;
+   using stake_stats = token::stake_stats;
+   using holder_delta = token::holder_delta;
+
+   static constexpr auto reward_precision = token::reward_precision;
+   static constexpr auto seconds_per_day = token::seconds_per_day;
+
+   static const symbol sym() { return symbol{ symbol_code{ "BWG" }, 4 }; }
+
+   // a row as the first release wrote it, without any appended field
+   static currency_stats legacy_stats() {
+      currency_stats st;
+      st.supply = asset{ 1000'0000, sym() };
+      st.max_supply = asset{ 10000'0000, sym() };
+      st.issuer = "issuer"_n;
+      st.refund_delay = 0;
+      st.fee_ratio = 0;
+      st.fee_receiver = "issuer"_n;
+      return st;
+   }
+
+   static currency_stats fee_stats( uint64_t ratio ) {
+      auto st = legacy_stats();
+      st.upgrade();
+      st.fee_ratio = ratio;
+      st.fee_enabled.value() = true;
+      return st;
+   }
+
+   static stake_stats stake_row( int64_t amount, uint8_t tier, uint32_t unlock_time ) {
+      stake_stats r;
+      r.owner = "alice"_n;
+      r.staked_balance = asset{ amount, sym() };
+      r.upgrade();
+      r.tier.value() = tier;
+      r.unlock_time.value() = unlock_time;
+      r.boosted.value() = token::boosted_weight( amount, tier );
+      return r;
+   }
+
+   static int64_t transfer_fee( const currency_stats& st, name from, name to, int64_t amount ) {
+      return token::transfer_fee( st, from, to, amount );
+   }
+   static int64_t fee_share( int64_t fee, uint64_t bps ) { return token::fee_share( fee, bps ); }
+   static uint64_t boosted_weight( int64_t amount, uint8_t tier ) { return token::boosted_weight( amount, tier ); }
+   static bool is_locked( const stake_stats& r, uint32_t now ) { return token::is_locked( r, now ); }
+   static void expire_lock( stake_stats& r, uint32_t now ) { token::expire_lock( r, now ); }
+   static void settle_rewards( stake_stats& r, uint128_t reward_per_share ) { token::settle_rewards( r, reward_per_share ); }
+   static int64_t pending_emission( const currency_stats& st, uint64_t weight, uint32_t now ) {
+      return token::pending_emission( st, weight, now );
+   }
+};
+
+using tt = token_tester;
+
+EOSIO_TEST_BEGIN(transfer_fee_test)
+   // the first release stored fee_ratio without charging it, an upgrade alone charges nothing
+   auto legacy = tt::legacy_stats();
+   legacy.fee_ratio = 5;
+   CHECK_EQUAL( tt::transfer_fee( legacy, "alice"_n, "bob"_n, 100'0000 ), 0 );
+
+   auto st = tt::fee_stats( 1 );
+   CHECK_EQUAL( tt::transfer_fee( st, "alice"_n, "bob"_n, 100'0000 ), 1'0000 );
+   CHECK_EQUAL( tt::transfer_fee( st, "alice"_n, "bob"_n, 99 ), 0 );
+
+   st.fee_ratio = 0;
+   CHECK_EQUAL( tt::transfer_fee( st, "alice"_n, "bob"_n, 100'0000 ), 0 );
+
+   // the exemption list is kept sorted, either side being listed waives the fee
+   st.fee_ratio = 2;
+   st.fee_exempt.value() = { "bob"_n, "exchange"_n };
+   CHECK_EQUAL( tt::transfer_fee( st, "alice"_n, "exchange"_n, 100'0000 ), 0 );
+   CHECK_EQUAL( tt::transfer_fee( st, "bob"_n, "alice"_n, 100'0000 ), 0 );
+   CHECK_EQUAL( tt::transfer_fee( st, "alice"_n, "carol"_n, 100'0000 ), 2'0000 );
+
+   // the largest asset amount does not overflow
+   st.fee_ratio = 100;
+   CHECK_EQUAL( tt::transfer_fee( st, "alice"_n, "carol"_n, asset::max_amount ), asset::max_amount );
+EOSIO_TEST_END
+
+EOSIO_TEST_BEGIN(fee_split_test)
+   CHECK_EQUAL( tt::fee_share( 1'0000, 0 ), 0 );
+   CHECK_EQUAL( tt::fee_share( 1'0000, 2500 ), 2500 );
+   CHECK_EQUAL( tt::fee_share( 1'0000, 10000 ), 1'0000 );
+
+   // shares round down, whatever is left over goes to the fee receiver
+   int64_t fee = 7;
+   auto burned = tt::fee_share( fee, 3333 );
+   auto to_stakers = tt::fee_share( fee, 3333 );
+   CHECK_EQUAL( burned, 2 );
+   CHECK_EQUAL( to_stakers, 2 );
+   CHECK_EQUAL( fee - burned - to_stakers, 3 );
+
+   CHECK_EQUAL( tt::fee_share( asset::max_amount, 10000 ), asset::max_amount );
+EOSIO_TEST_END
+
+EOSIO_TEST_BEGIN(lock_test)
+   CHECK_EQUAL( tt::boosted_weight( 100'0000, 0 ), 100'0000u );
+   CHECK_EQUAL( tt::boosted_weight( 100'0000, 1 ), 125'0000u );
+   CHECK_EQUAL( tt::boosted_weight( 100'0000, 2 ), 150'0000u );
+   CHECK_EQUAL( tt::boosted_weight( 100'0000, 3 ), 200'0000u );
+
+   // a row from before locks existed is never locked
+   tt::stake_stats legacy;
+   legacy.owner = "alice"_n;
+   legacy.staked_balance = asset{ 100'0000, tt::sym() };
+   CHECK_EQUAL( tt::is_locked( legacy, 0 ), false );
+
+   uint32_t now = 1'700'000'000;
+   auto unlock = now + 30 * tt::seconds_per_day;
+   auto r = tt::stake_row( 100'0000, 1, unlock );
+   CHECK_EQUAL( tt::is_locked( r, now ), true );
+   CHECK_EQUAL( tt::is_locked( r, unlock - 1 ), true );
+   CHECK_EQUAL( tt::is_locked( r, unlock ), false );
+
+   // unstake and refund are refused while locked, the lock is only dropped once it expired
+   tt::expire_lock( r, unlock - 1 );
+   CHECK_EQUAL( r.tier.value(), 1 );
+   CHECK_EQUAL( r.unlock_time.value(), unlock );
+
+   tt::expire_lock( r, unlock );
+   CHECK_EQUAL( r.tier.value(), 0 );
+   CHECK_EQUAL( r.unlock_time.value(), 0u );
+   CHECK_EQUAL( tt::is_locked( r, unlock ), false );
+EOSIO_TEST_END
+
+EOSIO_TEST_BEGIN(emission_test)
+   uint32_t now = 1'700'000'000;
+   auto st = tt::legacy_stats();
+   st.upgrade();
+   st.emission_rate.value() = 10;
+   st.last_emission.value() = now - 100;
+
+   CHECK_EQUAL( tt::pending_emission( st, 100'0000, now ), 1000 );
+   // nothing is minted without stakers, nor for time already settled
+   CHECK_EQUAL( tt::pending_emission( st, 0, now ), 0 );
+   CHECK_EQUAL( tt::pending_emission( st, 100'0000, now - 100 ), 0 );
+
+   // emission stops at max_supply
+   st.supply.amount = st.max_supply.amount - 300;
+   CHECK_EQUAL( tt::pending_emission( st, 100'0000, now ), 300 );
+   st.supply = st.max_supply;
+   CHECK_EQUAL( tt::pending_emission( st, 100'0000, now ), 0 );
+EOSIO_TEST_END
+
+EOSIO_TEST_BEGIN(claim_test)
+   // two stakers of equal stake, one locked for a year, share 3000 minted tokens 2:1
+   auto locked = tt::stake_row( 100'0000, 3, 0 );
+   auto unlocked = tt::stake_row( 100'0000, 0, 0 );
+   uint128_t total = locked.boosted.value() + unlocked.boosted.value();
+   uint128_t reward_per_share = uint128_t( 3000 ) * tt::reward_precision / total;
+
+   tt::settle_rewards( locked, reward_per_share );
+   tt::settle_rewards( unlocked, reward_per_share );
+   CHECK_EQUAL( locked.pending_reward.value(), 2000 );
+   CHECK_EQUAL( unlocked.pending_reward.value(), 1000 );
+   CHECK_EQUAL( locked.reward_debt.value() == reward_per_share, true );
+
+   // settling again without new rewards pays nothing twice
+   tt::settle_rewards( locked, reward_per_share );
+   CHECK_EQUAL( locked.pending_reward.value(), 2000 );
+
+   // once the lock expires the stake earns at tier 0
+   tt::expire_lock( locked, 0 );
+   locked.boosted.value() = tt::boosted_weight( locked.staked_balance.amount, locked.tier.value() );
+   reward_per_share += uint128_t( 2000 ) * tt::reward_precision / ( locked.boosted.value() + unlocked.boosted.value() );
+   tt::settle_rewards( locked, reward_per_share );
+   CHECK_EQUAL( locked.pending_reward.value(), 3000 );
+EOSIO_TEST_END
+
+EOSIO_TEST_BEGIN(holder_count_test)
+   auto st = tt::legacy_stats();
+   st.upgrade();
+   st.counted_through.value() = std::numeric_limits<uint64_t>::max();
+
+   tt::holder_delta delta{ st };
+   delta.balance( "alice"_n, 0, 5'0000 );
+   delta.apply( st );
+   CHECK_EQUAL( st.holders.value(), 1u );
+
+   // a count that would go below zero stops at zero
+   tt::holder_delta gone{ st };
+   gone.balance( "alice"_n, 5'0000, 0 );
+   gone.balance( "bob"_n, 5'0000, 0 );
+   gone.apply( st );
+   CHECK_EQUAL( st.holders.value(), 0u );
+EOSIO_TEST_END
+
+int main( int argc, char** argv ) {
+   bool verbose = false;
+   if( argc >= 2 && std::strcmp( argv[1], "-v" ) == 0 ) {
+      verbose = true;
+   }
+   silence_output( !verbose );
+
+   EOSIO_TEST( transfer_fee_test );
+   EOSIO_TEST( fee_split_test );
+   EOSIO_TEST( lock_test );
+   EOSIO_TEST( emission_test );
+   EOSIO_TEST( claim_test );
+   EOSIO_TEST( holder_count_test );
+   return has_failed();
+}